@@ -58,10 +58,16 @@
 #define ALIGNMENT 8  
 
 /* 
- * Maximum heap size in bytes 
+ * Default maximum heap size in bytes, it can be changed at runtime by
+ * the MEM_MAX_HEAP environment variable or the -m flag of the driver
  */
 #define MAX_HEAP (20*(1<<20))  /* 20 MB */
 
+/*
+ * Upper bound of the maximum heap size in bytes
+ */
+#define MAX_HEAP_LIMIT (1UL<<31)  /* 2 GB */
+
 /*****************************************************************************
  * Set exactly one of these USE_xxx constants to "1" to select a timing method
  *****************************************************************************/
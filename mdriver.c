@@ -29,6 +29,8 @@
 #define MAXLINE     1024 /* max string size */
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
+#define NUMPOLICIES    6 /* fit policy and insertion order pairs compared by -P */
+#define NUMSPLITS      6 /* split thresholds compared by -S */
 
 /* Returns true if p is ALIGNMENT-byte aligned */
 #define IS_ALIGNED(p)  ((((unsigned int)(p)) % ALIGNMENT) == 0)
@@ -46,9 +48,19 @@ typedef struct range_t {
 
 /* Characterizes a single trace operation (allocator request) */
 typedef struct {
-    enum {ALLOC, FREE, REALLOC} type; /* type of request */
+    enum {ALLOC, FREE, REALLOC, ALLOC_BATCH, FREE_BATCH,
+	  ARENA_ALLOC, ARENA_RESET, ALLOC_HINT, ALLOC_ALIGN,
+	  CALLOC, REINIT, FREE_SIZED, USABLE,
+	  HEAP_ALLOC, HEAP_DESTROY, CALLOC_HUGE} type; /* type of request */
     int index;                        /* index for free() to use later */
     int size;                         /* byte size of alloc/realloc request */
+                                      /* (caller's size for a sized free) */
+    int count;                        /* number of blocks of a batch request */
+                                      /* (ops index .. count-1 for a reset */
+                                      /* or destroy, 1 if a heap block is */
+                                      /* still live at its destroy) */
+    int hint;                         /* lifetime hint of a hinted alloc */
+    int align;                        /* alignment of an aligned alloc */
 } traceop_t;
 
 /* Holds the information for one trace file*/
@@ -81,6 +93,7 @@ typedef struct {
 
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
+    double thp_secs; /* secs needed in a heap backed by huge pages (-H only) */
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t; 
@@ -100,6 +113,21 @@ static char *default_tracefiles[] = {
     DEFAULT_TRACEFILES, NULL
 };
 
+/* The fit policies and insertion orders of mm.c compared by -P */
+static int policy_fit[NUMPOLICIES] = {
+    MM_FIRST_FIT, MM_FIRST_FIT, MM_BEST_FIT, MM_BEST_FIT, MM_NEXT_FIT, MM_NEXT_FIT
+};
+static int policy_order[NUMPOLICIES] = {
+    MM_LIFO, MM_ADDR_ORDER, MM_LIFO, MM_ADDR_ORDER, MM_LIFO, MM_ADDR_ORDER
+};
+static char *policy_names[NUMPOLICIES] = {
+    "first/lifo", "first/addr", "best/lifo", "best/addr", "next/lifo", "next/addr"
+};
+
+/* The split thresholds of mm.c compared by -S, 0 carves every block from the front */
+static size_t split_sizes[NUMSPLITS] = {0, 64, 128, 256, 512, 1024};
+static char *split_names[NUMSPLITS] = {"off", "64", "128", "256", "512", "1024"};
+
 
 /********************* 
  * Function prototypes 
@@ -127,6 +155,13 @@ static void eval_mm_speed(void *ptr);
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
+static void printthp(int n, stats_t *stats, int thp);
+static void set_policy(int p);
+static void set_split(int p);
+static void evalconfigs(char **tracefiles, int n, int count, char **names,
+			char *what, void (*set)(int));
+static void printconfigs(int n, int count, char **names, char *what,
+			 stats_t **stats);
 static void usage(void);
 static void unix_error(char *msg);
 static void malloc_error(int tracenum, int opnum, char *msg);
@@ -150,6 +185,10 @@ int main(int argc, char **argv)
     int team_check = 1;  /* If set, check team structure (reset by -a) */
     int run_libc = 0;    /* If set, run libc malloc (set by -l) */
     int autograder = 0;  /* If set, emit summary info for autograder (-g) */
+    int run_thp = 0;     /* If set, time mm malloc with huge pages as well (-H) */
+    int thp = 0;         /* Are huge pages actually used by the -H runs? */
+    int run_policies = 0;/* If set, run mm malloc under every fit policy (-P) */
+    int run_splits = 0;  /* If set, run mm malloc under every split threshold (-S) */
 
     /* temporaries used to compute the performance index */
     double secs, ops, util, avg_mm_util, avg_mm_throughput, p1, p2, perfindex;
@@ -158,7 +197,7 @@ int main(int argc, char **argv)
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    while ((c = getopt(argc, argv, "f:t:m:hvVgalHPS")) != EOF) {
         switch (c) {
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
@@ -178,12 +217,28 @@ int main(int argc, char **argv)
 	    if (tracedir[strlen(tracedir)-1] != '/') 
 		strcat(tracedir, "/"); /* path always ends with "/" */
 	    break;
+	case 'm': /* Maximum heap size in MB */
+	    if (atoi(optarg) <= 0) {
+		usage();
+		exit(1);
+	    }
+	    mem_set_max_heapsize((size_t)atoi(optarg) << 20);
+	    break;
         case 'a': /* Don't check team structure */
             team_check = 0;
             break;
         case 'l': /* Run libc malloc */
             run_libc = 1;
             break;
+        case 'H': /* Time mm malloc with transparent huge pages as well */
+            run_thp = 1;
+            break;
+        case 'P': /* Compare the fit policies of mm malloc */
+            run_policies = 1;
+            break;
+        case 'S': /* Compare the split thresholds of mm malloc */
+            run_splits = 1;
+            break;
         case 'v': /* Print per-trace performance breakdown */
             verbose = 1;
             break;
@@ -303,6 +358,17 @@ int main(int argc, char **argv)
 	    if (verbose > 1)
 		printf("and performance.\n");
 	    mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
+	    if (run_thp) {
+		/* time the trace again in a heap asking for huge pages */
+		mem_deinit();
+		mem_set_hugepages(1);
+		mem_init();
+		thp = mem_hugepages();
+		mm_stats[i].thp_secs = fsecs(eval_mm_speed, &speed_params);
+		mem_deinit();
+		mem_set_hugepages(0);
+		mem_init();
+	    }
 	}
 	free_trace(trace);
     }
@@ -314,6 +380,26 @@ int main(int argc, char **argv)
 	printf("\n");
     }
 
+    /* Display the throughput with and without huge pages */
+    if (run_thp) {
+	printthp(num_tracefiles, mm_stats, thp);
+	printf("\n");
+    }
+
+    /* Display the utilization and throughput under every fit policy */
+    if (run_policies) {
+	evalconfigs(tracefiles, num_tracefiles, NUMPOLICIES, policy_names,
+		    "fit policy", set_policy);
+	printf("\n");
+    }
+
+    /* Display the utilization and throughput under every split threshold */
+    if (run_splits) {
+	evalconfigs(tracefiles, num_tracefiles, NUMSPLITS, split_names,
+		    "split threshold", set_split);
+	printf("\n");
+    }
+
     /* 
      * Accumulate the aggregate statistics for the student's mm package 
      */
@@ -395,9 +481,10 @@ static int add_range(range_t **ranges, char *lo, int size,
         return 0;
     }
 
-    /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
-	(hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
+    /* The payload must lie within the extent of a heap or a mapping */
+    if (((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
+	 (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) &&
+	!mem_in_map(lo, hi) && !mem_in_region(lo, hi)) {
 	sprintf(msg, "Payload (%p:%p) lies outside heap (%p:%p)",
 		lo, hi, mem_heap_lo(), mem_heap_hi());
 	malloc_error(tracenum, opnum, msg);
@@ -477,9 +564,13 @@ static trace_t *read_trace(char *tracedir, char *filename)
     trace_t *trace;
     char type[MAXLINE];
     char path[MAXLINE];
-    unsigned index, size;
+    unsigned index, size, count;
     unsigned max_index = 0;
     unsigned op_index;
+    unsigned arena_start = 0;
+    unsigned heap_start = 0;
+    int *heap_op;         /* op of each live block of the driver's heap */
+    int j;
 
     if (verbose > 1)
 	printf("Reading tracefile: %s\n", filename);
@@ -514,6 +605,12 @@ static trace_t *read_trace(char *tracedir, char *filename)
     if ((trace->block_sizes = 
 	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
 	unix_error("malloc 4 failed in read_trace");
+
+    /* ... and, while reading, the alloc op of each live heap block */
+    if ((heap_op = (int *)malloc(trace->num_ids * sizeof(int))) == NULL)
+	unix_error("malloc 5 failed in read_trace");
+    for (j = 0; j < trace->num_ids; j++)
+	heap_op[j] = -1;
     
     /* read every request line in the trace file */
     index = 0;
@@ -538,6 +635,110 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	    fscanf(tracefile, "%ud", &index);
 	    trace->ops[op_index].type = FREE;
 	    trace->ops[op_index].index = index;
+	    if (index < trace->num_ids && heap_op[index] >= 0) {
+		trace->ops[heap_op[index]].count = 0;
+		heap_op[index] = -1;
+	    }
+	    break;
+	case 'F': /* free with a size known to the caller */
+	    fscanf(tracefile, "%u %u", &index, &size);
+	    trace->ops[op_index].type = FREE_SIZED;
+	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].size = size;
+	    if (index < trace->num_ids && heap_op[index] >= 0) {
+		trace->ops[heap_op[index]].count = 0;
+		heap_op[index] = -1;
+	    }
+	    break;
+	case 'u': /* query the usable size and use all of it */
+	    fscanf(tracefile, "%u", &index);
+	    trace->ops[op_index].type = USABLE;
+	    trace->ops[op_index].index = index;
+	    break;
+	case 'b': /* allocate blocks index .. index+count-1 at once */
+	    fscanf(tracefile, "%u %u %u", &index, &count, &size);
+	    trace->ops[op_index].type = ALLOC_BATCH;
+	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].count = count;
+	    trace->ops[op_index].size = size;
+	    max_index = (index + count - 1 > max_index) ? index + count - 1 : max_index;
+	    break;
+	case 'B': /* free blocks index .. index+count-1 at once */
+	    fscanf(tracefile, "%u %u", &index, &count);
+	    trace->ops[op_index].type = FREE_BATCH;
+	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].count = count;
+	    for (j = index; j < index + count && j < trace->num_ids; j++) {
+		if (heap_op[j] >= 0) {
+		    trace->ops[heap_op[j]].count = 0;
+		    heap_op[j] = -1;
+		}
+	    }
+	    break;
+	case 'h': /* allocate with a lifetime hint, s(hort) or l(ong) */
+	    fscanf(tracefile, "%u %u %s", &index, &size, type);
+	    trace->ops[op_index].type = ALLOC_HINT;
+	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].size = size;
+	    trace->ops[op_index].hint = type[0] == 's' ? MM_SHORT : MM_LONG;
+	    max_index = (index > max_index) ? index : max_index;
+	    break;
+	case 'm': /* allocate with an alignment (power of two) */
+	    fscanf(tracefile, "%u %u %u", &index, &count, &size);
+	    trace->ops[op_index].type = ALLOC_ALIGN;
+	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].align = count;
+	    trace->ops[op_index].size = size;
+	    max_index = (index > max_index) ? index : max_index;
+	    break;
+	case 'c': /* allocate a zeroed block */
+	    fscanf(tracefile, "%u %u", &index, &size);
+	    trace->ops[op_index].type = CALLOC;
+	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].size = size;
+	    max_index = (index > max_index) ? index : max_index;
+	    break;
+	case 'C': /* calloc of count elements of SIZE_MAX >> size bytes, must fail */
+	    fscanf(tracefile, "%u %u", &count, &size);
+	    trace->ops[op_index].type = CALLOC_HUGE;
+	    trace->ops[op_index].count = count;
+	    trace->ops[op_index].size = size;
+	    break;
+	case 'I': /* reset the heap and call mm_init, no block may be live */
+	    trace->ops[op_index].type = REINIT;
+	    break;
+	case 'x': /* allocate a block from the arena */
+	    fscanf(tracefile, "%u %u", &index, &size);
+	    trace->ops[op_index].type = ARENA_ALLOC;
+	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].size = size;
+	    max_index = (index > max_index) ? index : max_index;
+	    break;
+	case 'X': /* release every block of the arena */
+	    trace->ops[op_index].type = ARENA_RESET;
+	    trace->ops[op_index].index = arena_start;
+	    trace->ops[op_index].count = op_index;
+	    arena_start = op_index + 1;
+	    break;
+	case 'n': /* allocate a block from the driver's own heap */
+	    fscanf(tracefile, "%u %u", &index, &size);
+	    trace->ops[op_index].type = HEAP_ALLOC;
+	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].size = size;
+	    trace->ops[op_index].count = 1;
+	    if (index < trace->num_ids)
+		heap_op[index] = op_index;
+	    max_index = (index > max_index) ? index : max_index;
+	    break;
+	case 'N': /* destroy the heap with the blocks still live in it */
+	    trace->ops[op_index].type = HEAP_DESTROY;
+	    trace->ops[op_index].index = heap_start;
+	    trace->ops[op_index].count = op_index;
+	    for (j = heap_start; j < op_index; j++)
+		if (trace->ops[j].type == HEAP_ALLOC &&
+		    trace->ops[j].index < trace->num_ids)
+		    heap_op[trace->ops[j].index] = -1;
+	    heap_start = op_index + 1;
 	    break;
 	default:
 	    printf("Bogus type character (%c) in tracefile %s\n", 
@@ -548,6 +749,7 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	
     }
     fclose(tracefile);
+    free(heap_op);
     assert(max_index == trace->num_ids - 1);
     assert(trace->num_ops == op_index);
     
@@ -579,10 +781,13 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
     int i, j;
     int index;
     int size;
+    int count;
     int oldsize;
     char *newp;
     char *oldp;
     char *p;
+    mm_arena_t *arena = NULL;
+    mm_heap_t *heap = NULL;
     
     /* Reset the heap and free any records in the range list */
     mem_reset_brk();
@@ -602,9 +807,12 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
         switch (trace->ops[i].type) {
 
         case ALLOC: /* mm_malloc */
+        case ALLOC_HINT: /* mm_malloc_hint */
 
 	    /* Call the student's malloc */
-	    if ((p = mm_malloc(size)) == NULL) {
+	    p = trace->ops[i].type == ALLOC ? mm_malloc(size) :
+		mm_malloc_hint(size, trace->ops[i].hint);
+	    if (p == NULL) {
 		malloc_error(tracenum, i, "mm_malloc failed.");
 		return 0;
 	    }
@@ -653,7 +861,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    oldsize = trace->block_sizes[index];
 	    if (size < oldsize) oldsize = size;
 	    for (j = 0; j < oldsize; j++) {
-	      if (newp[j] != (index & 0xFF)) {
+	      if ((unsigned char)newp[j] != (index & 0xFF)) {
 		malloc_error(tracenum, i, "mm_realloc did not preserve the "
 			     "data from old block");
 		return 0;
@@ -674,11 +882,201 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    mm_free(p);
 	    break;
 
+        case ALLOC_ALIGN: /* mm_memalign */
+
+	    /* Call the student's aligned malloc */
+	    if ((p = mm_memalign(trace->ops[i].align, size)) == NULL) {
+		malloc_error(tracenum, i, "mm_memalign failed.");
+		return 0;
+	    }
+
+	    /* The payload must have the requested alignment */
+	    if ((unsigned long)p & (trace->ops[i].align - 1)) {
+		sprintf(msg, "Payload address (%p) not aligned to %d bytes",
+			p, trace->ops[i].align);
+		malloc_error(tracenum, i, msg);
+		return 0;
+	    }
+
+	    /* Check and fill the block like a single mm_malloc */
+	    if (add_range(ranges, p, size, tracenum, i) == 0)
+		return 0;
+	    memset(p, index & 0xFF, size);
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    break;
+
+        case CALLOC: /* mm_calloc */
+
+	    /* Call the student's calloc */
+	    if ((p = mm_calloc(1, size)) == NULL) {
+		malloc_error(tracenum, i, "mm_calloc failed.");
+		return 0;
+	    }
+	    if (add_range(ranges, p, size, tracenum, i) == 0)
+		return 0;
+
+	    /* The payload must be zero before we fill it */
+	    for (j = 0; j < size; j++) {
+		if (p[j] != 0) {
+		    malloc_error(tracenum, i, "mm_calloc did not zero the block");
+		    return 0;
+		}
+	    }
+	    memset(p, index & 0xFF, size);
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    break;
+
+        case CALLOC_HUGE: /* mm_calloc that cannot be served */
+
+	    /* The total size overflows or leaves no room for a header */
+	    if (mm_calloc(trace->ops[i].count, (size_t)-1 >> size) != NULL) {
+		sprintf(msg, "mm_calloc(%d, SIZE_MAX >> %d) did not fail",
+			trace->ops[i].count, size);
+		malloc_error(tracenum, i, msg);
+		return 0;
+	    }
+	    break;
+
+        case REINIT: /* mm_init */
+
+	    /* The old heap is dropped with whatever it still holds */
+	    if (*ranges != NULL)
+		app_error("Blocks are still allocated at a reinit request");
+	    mem_reset_brk();
+	    if (mm_init() < 0) {
+		malloc_error(tracenum, i, "mm_init failed.");
+		return 0;
+	    }
+	    arena = NULL;
+	    break;
+
+        case FREE_SIZED: /* mm_free_sized */
+
+	    /* Remove region from list and call student's sized free */
+	    p = trace->blocks[index];
+	    remove_range(ranges, p);
+	    mm_free_sized(p, size);
+	    break;
+
+        case USABLE: /* mm_usable_size */
+
+	    /* The block must hold at least the size it was requested with */
+	    p = trace->blocks[index];
+	    size = mm_usable_size(p);
+	    if (size < trace->block_sizes[index]) {
+		sprintf(msg, "mm_usable_size returned %d for a block of %d bytes",
+			size, (int)trace->block_sizes[index]);
+		malloc_error(tracenum, i, msg);
+		return 0;
+	    }
+
+	    /* The whole usable size must not overlap any other payload */
+	    remove_range(ranges, p);
+	    if (add_range(ranges, p, size, tracenum, i) == 0)
+		return 0;
+	    memset(p, index & 0xFF, size);
+	    trace->block_sizes[index] = size;
+	    break;
+
+        case ALLOC_BATCH: /* mm_malloc_batch */
+
+	    /* Call the student's batch malloc */
+	    count = trace->ops[i].count;
+	    if (mm_malloc_batch(size, count, 
+				(void **)&trace->blocks[index]) != count) {
+		malloc_error(tracenum, i, "mm_malloc_batch failed.");
+		return 0;
+	    }
+
+	    /* Check and fill every block like a single mm_malloc */
+	    for (j = 0; j < count; j++) {
+		p = trace->blocks[index + j];
+		if (add_range(ranges, p, size, tracenum, i) == 0)
+		    return 0;
+		memset(p, (index + j) & 0xFF, size);
+		trace->block_sizes[index + j] = size;
+	    }
+	    break;
+
+        case FREE_BATCH: /* mm_free_batch */
+
+	    /* Remove regions from list and call student's batch free */
+	    count = trace->ops[i].count;
+	    for (j = 0; j < count; j++)
+		remove_range(ranges, trace->blocks[index + j]);
+	    mm_free_batch((void **)&trace->blocks[index], count);
+	    break;
+
+        case ARENA_ALLOC: /* mm_arena_alloc */
+
+	    /* The arena is created by its first request */
+	    if (arena == NULL && (arena = mm_arena_create()) == NULL) {
+		malloc_error(tracenum, i, "mm_arena_create failed.");
+		return 0;
+	    }
+	    if ((p = mm_arena_alloc(arena, size)) == NULL) {
+		malloc_error(tracenum, i, "mm_arena_alloc failed.");
+		return 0;
+	    }
+
+	    /* Check and fill the block like a single mm_malloc */
+	    if (add_range(ranges, p, size, tracenum, i) == 0)
+		return 0;
+	    memset(p, index & 0xFF, size);
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    break;
+
+        case ARENA_RESET: /* mm_arena_reset */
+
+	    /* Remove the regions of the arena blocks since the last reset */
+	    for (j = index; j < trace->ops[i].count; j++)
+		if (trace->ops[j].type == ARENA_ALLOC)
+		    remove_range(ranges, trace->blocks[trace->ops[j].index]);
+	    if (arena != NULL)
+		mm_arena_reset(arena);
+	    break;
+
+        case HEAP_ALLOC: /* mm_heap_malloc */
+
+	    /* The heap is created by its first request */
+	    if (heap == NULL && (heap = mm_heap_create()) == NULL) {
+		malloc_error(tracenum, i, "mm_heap_create failed.");
+		return 0;
+	    }
+	    if ((p = mm_heap_malloc(heap, size)) == NULL) {
+		malloc_error(tracenum, i, "mm_heap_malloc failed.");
+		return 0;
+	    }
+
+	    /* Check and fill the block like a single mm_malloc */
+	    if (add_range(ranges, p, size, tracenum, i) == 0)
+		return 0;
+	    memset(p, index & 0xFF, size);
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    break;
+
+        case HEAP_DESTROY: /* mm_heap_destroy */
+
+	    /* Remove the regions of the heap blocks that are still live */
+	    for (j = index; j < trace->ops[i].count; j++)
+		if (trace->ops[j].type == HEAP_ALLOC && trace->ops[j].count)
+		    remove_range(ranges, trace->blocks[trace->ops[j].index]);
+	    if (heap != NULL)
+		mm_heap_destroy(heap);
+	    heap = NULL;
+	    break;
+
 	default:
 	    app_error("Nonexistent request type in eval_mm_valid");
         }
 
     }
+    if (heap != NULL)
+	mm_heap_destroy(heap);
 
     /* As far as we know, this is a valid malloc package */
     return 1;
@@ -689,21 +1087,24 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
  *   The idea is to remember the high water mark "hwm" of the heap for 
  *   an optimal allocator, i.e., no gaps and no internal fragmentation.
  *   Utilization is the ratio hwm/heapsize, where heapsize is the 
- *   size of the heap in bytes after running the student's malloc 
- *   package on the trace. Note that our implementation of mem_sbrk() 
- *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap. 
+ *   peak size of the heap plus the mappings in bytes while running the
+ *   student's malloc package on the trace. mem_sbrk() allows the students
+ *   to decrement the brk pointer, so the final brk may be below the peak
+ *   heap size.
  *   
  */
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 {   
-    int i;
+    int i, j;
     int index;
     int size, newsize, oldsize;
     int max_total_size = 0;
     int total_size = 0;
+    size_t peak = 0;
     char *p;
     char *newp, *oldp;
+    mm_arena_t *arena = NULL;
+    mm_heap_t *heap = NULL;
 
     /* initialize the heap and the mm malloc package */
     mem_reset_brk();
@@ -714,10 +1115,13 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
         switch (trace->ops[i].type) {
 
         case ALLOC: /* mm_alloc */
+        case ALLOC_HINT: /* mm_malloc_hint */
 	    index = trace->ops[i].index;
 	    size = trace->ops[i].size;
 
-	    if ((p = mm_malloc(size)) == NULL) 
+	    p = trace->ops[i].type == ALLOC ? mm_malloc(size) :
+		mm_malloc_hint(size, trace->ops[i].hint);
+	    if (p == NULL) 
 		app_error("mm_malloc failed in eval_mm_util");
 	    
 	    /* Remember region and size */
@@ -768,13 +1172,143 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    
 	    break;
 
+	case ALLOC_ALIGN: /* mm_memalign */
+	    index = trace->ops[i].index;
+	    size = trace->ops[i].size;
+
+	    if ((p = mm_memalign(trace->ops[i].align, size)) == NULL)
+		app_error("mm_memalign failed in eval_mm_util");
+
+	    /* Remember region and size, update statistics */
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    total_size += size;
+	    max_total_size = (total_size > max_total_size) ?
+		total_size : max_total_size;
+	    break;
+
+	case CALLOC: /* mm_calloc */
+	    index = trace->ops[i].index;
+	    size = trace->ops[i].size;
+
+	    if ((p = mm_calloc(1, size)) == NULL)
+		app_error("mm_calloc failed in eval_mm_util");
+
+	    /* Remember region and size, update statistics */
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    total_size += size;
+	    max_total_size = (total_size > max_total_size) ?
+		total_size : max_total_size;
+	    break;
+
+	case CALLOC_HUGE: /* fails, checked by eval_mm_valid */
+	    break;
+
+	case REINIT: /* mm_init, the peak of the old heap still counts */
+	    if (mem_peak_footprint() > peak)
+		peak = mem_peak_footprint();
+	    mem_reset_brk();
+	    if (mm_init() < 0)
+		app_error("mm_init failed in eval_mm_util");
+	    arena = NULL;
+	    break;
+
+	case FREE_SIZED: /* mm_free_sized */
+	    index = trace->ops[i].index;
+	    total_size -= trace->block_sizes[index];
+	    mm_free_sized(trace->blocks[index], trace->ops[i].size);
+	    break;
+
+	case USABLE: /* mm_usable_size, only the requested size counts */
+	    mm_usable_size(trace->blocks[trace->ops[i].index]);
+	    break;
+
+	case ALLOC_BATCH: /* mm_malloc_batch */
+	    index = trace->ops[i].index;
+	    size = trace->ops[i].size;
+
+	    if (mm_malloc_batch(size, trace->ops[i].count, 
+				(void **)&trace->blocks[index]) != trace->ops[i].count)
+		app_error("mm_malloc_batch failed in eval_mm_util");
+
+	    /* Remember sizes and update statistics */
+	    for (j = 0; j < trace->ops[i].count; j++)
+		trace->block_sizes[index + j] = size;
+	    total_size += size * trace->ops[i].count;
+	    max_total_size = (total_size > max_total_size) ?
+		total_size : max_total_size;
+	    break;
+
+	case FREE_BATCH: /* mm_free_batch */
+	    index = trace->ops[i].index;
+	    for (j = 0; j < trace->ops[i].count; j++)
+		total_size -= trace->block_sizes[index + j];
+	    mm_free_batch((void **)&trace->blocks[index], trace->ops[i].count);
+	    break;
+
+	case ARENA_ALLOC: /* mm_arena_alloc */
+	    index = trace->ops[i].index;
+	    size = trace->ops[i].size;
+
+	    if (arena == NULL && (arena = mm_arena_create()) == NULL)
+		app_error("mm_arena_create failed in eval_mm_util");
+	    if ((p = mm_arena_alloc(arena, size)) == NULL)
+		app_error("mm_arena_alloc failed in eval_mm_util");
+
+	    /* Remember region and size, update statistics */
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    total_size += size;
+	    max_total_size = (total_size > max_total_size) ?
+		total_size : max_total_size;
+	    break;
+
+	case ARENA_RESET: /* mm_arena_reset */
+	    for (j = trace->ops[i].index; j < trace->ops[i].count; j++)
+		if (trace->ops[j].type == ARENA_ALLOC)
+		    total_size -= trace->block_sizes[trace->ops[j].index];
+	    if (arena != NULL)
+		mm_arena_reset(arena);
+	    break;
+
+	case HEAP_ALLOC: /* mm_heap_malloc */
+	    index = trace->ops[i].index;
+	    size = trace->ops[i].size;
+
+	    if (heap == NULL && (heap = mm_heap_create()) == NULL)
+		app_error("mm_heap_create failed in eval_mm_util");
+	    if ((p = mm_heap_malloc(heap, size)) == NULL)
+		app_error("mm_heap_malloc failed in eval_mm_util");
+
+	    /* Remember region and size, update statistics */
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    total_size += size;
+	    max_total_size = (total_size > max_total_size) ?
+		total_size : max_total_size;
+	    break;
+
+	case HEAP_DESTROY: /* mm_heap_destroy */
+	    for (j = trace->ops[i].index; j < trace->ops[i].count; j++)
+		if (trace->ops[j].type == HEAP_ALLOC && trace->ops[j].count)
+		    total_size -= trace->block_sizes[trace->ops[j].index];
+	    if (heap != NULL)
+		mm_heap_destroy(heap);
+	    heap = NULL;
+	    break;
+
 	default:
 	    app_error("Nonexistent request type in eval_mm_util");
 
         }
     }
+    if (heap != NULL)
+	mm_heap_destroy(heap);
 
-    return ((double)max_total_size / (double)mem_heapsize());
+    if (mem_peak_footprint() > peak)
+	peak = mem_peak_footprint();
+    return ((double)max_total_size / (double)peak);
 }
 
 
@@ -787,6 +1321,8 @@ static void eval_mm_speed(void *ptr)
     int i, index, size, newsize;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
+    mm_arena_t *arena = NULL;
+    mm_heap_t *heap = NULL;
 
     /* Reset the heap and initialize the mm package */
     mem_reset_brk();
@@ -798,9 +1334,12 @@ static void eval_mm_speed(void *ptr)
         switch (trace->ops[i].type) {
 
         case ALLOC: /* mm_malloc */
+        case ALLOC_HINT: /* mm_malloc_hint */
             index = trace->ops[i].index;
             size = trace->ops[i].size;
-            if ((p = mm_malloc(size)) == NULL)
+            p = trace->ops[i].type == ALLOC ? mm_malloc(size) :
+		mm_malloc_hint(size, trace->ops[i].hint);
+            if (p == NULL)
 		app_error("mm_malloc error in eval_mm_speed");
             trace->blocks[index] = p;
             break;
@@ -820,9 +1359,81 @@ static void eval_mm_speed(void *ptr)
             mm_free(block);
             break;
 
+	case ALLOC_ALIGN: /* mm_memalign */
+	    if ((p = mm_memalign(trace->ops[i].align, trace->ops[i].size)) == NULL)
+		app_error("mm_memalign error in eval_mm_speed");
+	    trace->blocks[trace->ops[i].index] = p;
+	    break;
+
+	case CALLOC: /* mm_calloc */
+	    if ((p = mm_calloc(1, trace->ops[i].size)) == NULL)
+		app_error("mm_calloc error in eval_mm_speed");
+	    trace->blocks[trace->ops[i].index] = p;
+	    break;
+
+	case CALLOC_HUGE: /* fails, checked by eval_mm_valid */
+	    break;
+
+	case REINIT: /* mm_init */
+	    mem_reset_brk();
+	    if (mm_init() < 0)
+		app_error("mm_init failed in eval_mm_speed");
+	    arena = NULL;
+	    break;
+
+	case FREE_SIZED: /* mm_free_sized */
+	    mm_free_sized(trace->blocks[trace->ops[i].index], trace->ops[i].size);
+	    break;
+
+	case USABLE: /* mm_usable_size */
+	    mm_usable_size(trace->blocks[trace->ops[i].index]);
+	    break;
+
+	case ALLOC_BATCH: /* mm_malloc_batch */
+	    index = trace->ops[i].index;
+	    if (mm_malloc_batch(trace->ops[i].size, trace->ops[i].count, 
+				(void **)&trace->blocks[index]) != trace->ops[i].count)
+		app_error("mm_malloc_batch error in eval_mm_speed");
+	    break;
+
+	case FREE_BATCH: /* mm_free_batch */
+	    index = trace->ops[i].index;
+	    mm_free_batch((void **)&trace->blocks[index], trace->ops[i].count);
+	    break;
+
+	case ARENA_ALLOC: /* mm_arena_alloc */
+	    if (arena == NULL && (arena = mm_arena_create()) == NULL)
+		app_error("mm_arena_create error in eval_mm_speed");
+	    if ((p = mm_arena_alloc(arena, trace->ops[i].size)) == NULL)
+		app_error("mm_arena_alloc error in eval_mm_speed");
+	    trace->blocks[trace->ops[i].index] = p;
+	    break;
+
+	case ARENA_RESET: /* mm_arena_reset */
+	    if (arena != NULL)
+		mm_arena_reset(arena);
+	    break;
+
+	case HEAP_ALLOC: /* mm_heap_malloc */
+	    if (heap == NULL && (heap = mm_heap_create()) == NULL)
+		app_error("mm_heap_create error in eval_mm_speed");
+	    if ((p = mm_heap_malloc(heap, trace->ops[i].size)) == NULL)
+		app_error("mm_heap_malloc error in eval_mm_speed");
+	    trace->blocks[trace->ops[i].index] = p;
+	    break;
+
+	case HEAP_DESTROY: /* mm_heap_destroy */
+	    if (heap != NULL)
+		mm_heap_destroy(heap);
+	    heap = NULL;
+	    break;
+
 	default:
 	    app_error("Nonexistent request type in eval_mm_valid");
         }
+
+    if (heap != NULL)
+	mm_heap_destroy(heap);
 }
 
 /*
@@ -833,13 +1444,14 @@ static void eval_mm_speed(void *ptr)
  */
 static int eval_libc_valid(trace_t *trace, int tracenum)
 {
-    int i, newsize;
+    int i, j, newsize;
     char *p, *newp, *oldp;
 
     for (i = 0;  i < trace->num_ops;  i++) {
         switch (trace->ops[i].type) {
 
         case ALLOC: /* malloc */
+        case ALLOC_HINT: /* malloc, libc takes no hint */
 	    if ((p = malloc(trace->ops[i].size)) == NULL) {
 		malloc_error(tracenum, i, "libc malloc failed");
 		unix_error("System message");
@@ -861,6 +1473,77 @@ static int eval_libc_valid(trace_t *trace, int tracenum)
 	    free(trace->blocks[trace->ops[i].index]);
 	    break;
 
+	case ALLOC_ALIGN: /* posix_memalign */
+	    if (posix_memalign((void **)&p, trace->ops[i].align,
+			       trace->ops[i].size) != 0) {
+		malloc_error(tracenum, i, "libc posix_memalign failed");
+		unix_error("System message");
+	    }
+	    trace->blocks[trace->ops[i].index] = p;
+	    break;
+
+	case CALLOC: /* calloc */
+	    if ((p = calloc(1, trace->ops[i].size)) == NULL) {
+		malloc_error(tracenum, i, "libc calloc failed");
+		unix_error("System message");
+	    }
+	    trace->blocks[trace->ops[i].index] = p;
+	    break;
+
+	case CALLOC_HUGE: /* libc is not checked */
+	case REINIT: /* nothing to reset */
+	    break;
+
+	case FREE_SIZED: /* free */
+	    free(trace->blocks[trace->ops[i].index]);
+	    break;
+
+	case USABLE: /* libc has no portable usable size */
+	    break;
+
+	case ALLOC_BATCH: /* one malloc per block */
+	    for (j = 0; j < trace->ops[i].count; j++) {
+		if ((p = malloc(trace->ops[i].size)) == NULL) {
+		    malloc_error(tracenum, i, "libc malloc failed");
+		    unix_error("System message");
+		}
+		trace->blocks[trace->ops[i].index + j] = p;
+	    }
+	    break;
+
+	case FREE_BATCH: /* one free per block */
+	    for (j = 0; j < trace->ops[i].count; j++)
+		free(trace->blocks[trace->ops[i].index + j]);
+	    break;
+
+	case ARENA_ALLOC: /* malloc */
+	    if ((p = malloc(trace->ops[i].size)) == NULL) {
+		malloc_error(tracenum, i, "libc malloc failed");
+		unix_error("System message");
+	    }
+	    trace->blocks[trace->ops[i].index] = p;
+	    break;
+
+	case ARENA_RESET: /* one free per arena block */
+	    for (j = trace->ops[i].index; j < trace->ops[i].count; j++)
+		if (trace->ops[j].type == ARENA_ALLOC)
+		    free(trace->blocks[trace->ops[j].index]);
+	    break;
+
+	case HEAP_ALLOC: /* malloc */
+	    if ((p = malloc(trace->ops[i].size)) == NULL) {
+		malloc_error(tracenum, i, "libc malloc failed");
+		unix_error("System message");
+	    }
+	    trace->blocks[trace->ops[i].index] = p;
+	    break;
+
+	case HEAP_DESTROY: /* one free per live heap block */
+	    for (j = trace->ops[i].index; j < trace->ops[i].count; j++)
+		if (trace->ops[j].type == HEAP_ALLOC && trace->ops[j].count)
+		    free(trace->blocks[trace->ops[j].index]);
+	    break;
+
 	default:
 	    app_error("invalid operation type  in eval_libc_valid");
 	}
@@ -876,7 +1559,7 @@ static int eval_libc_valid(trace_t *trace, int tracenum)
  */
 static void eval_libc_speed(void *ptr)
 {
-    int i;
+    int i, j;
     int index, size, newsize;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
@@ -884,6 +1567,7 @@ static void eval_libc_speed(void *ptr)
     for (i = 0;  i < trace->num_ops;  i++) {
         switch (trace->ops[i].type) {
         case ALLOC: /* malloc */
+        case ALLOC_HINT: /* malloc, libc takes no hint */
 	    index = trace->ops[i].index;
 	    size = trace->ops[i].size;
 	    if ((p = malloc(size)) == NULL)
@@ -906,6 +1590,69 @@ static void eval_libc_speed(void *ptr)
 	    block = trace->blocks[index];
 	    free(block);
 	    break;
+
+	case ALLOC_ALIGN: /* posix_memalign */
+	    if (posix_memalign((void **)&p, trace->ops[i].align,
+			       trace->ops[i].size) != 0)
+		unix_error("posix_memalign failed in eval_libc_speed");
+	    trace->blocks[trace->ops[i].index] = p;
+	    break;
+
+	case CALLOC: /* calloc */
+	    if ((p = calloc(1, trace->ops[i].size)) == NULL)
+		unix_error("calloc failed in eval_libc_speed");
+	    trace->blocks[trace->ops[i].index] = p;
+	    break;
+
+	case CALLOC_HUGE: /* libc is not checked */
+	case REINIT: /* nothing to reset */
+	    break;
+
+	case FREE_SIZED: /* free */
+	    free(trace->blocks[trace->ops[i].index]);
+	    break;
+
+	case USABLE: /* libc has no portable usable size */
+	    break;
+
+	case ALLOC_BATCH: /* one malloc per block */
+	    index = trace->ops[i].index;
+	    for (j = 0; j < trace->ops[i].count; j++) {
+		if ((p = malloc(trace->ops[i].size)) == NULL)
+		    unix_error("malloc failed in eval_libc_speed");
+		trace->blocks[index + j] = p;
+	    }
+	    break;
+
+	case FREE_BATCH: /* one free per block */
+	    index = trace->ops[i].index;
+	    for (j = 0; j < trace->ops[i].count; j++)
+		free(trace->blocks[index + j]);
+	    break;
+
+	case ARENA_ALLOC: /* malloc */
+	    if ((p = malloc(trace->ops[i].size)) == NULL)
+		unix_error("malloc failed in eval_libc_speed");
+	    trace->blocks[trace->ops[i].index] = p;
+	    break;
+
+	case ARENA_RESET: /* one free per arena block */
+	    for (j = trace->ops[i].index; j < trace->ops[i].count; j++)
+		if (trace->ops[j].type == ARENA_ALLOC)
+		    free(trace->blocks[trace->ops[j].index]);
+	    break;
+
+	case HEAP_ALLOC: /* malloc */
+	    if ((p = malloc(trace->ops[i].size)) == NULL)
+		unix_error("malloc failed in eval_libc_speed");
+	    trace->blocks[trace->ops[i].index] = p;
+	    break;
+
+	case HEAP_DESTROY: /* one free per live heap block */
+	    for (j = trace->ops[i].index; j < trace->ops[i].count; j++)
+		if (trace->ops[j].type == HEAP_ALLOC && trace->ops[j].count)
+		    free(trace->blocks[trace->ops[j].index]);
+	    break;
 	}
     }
 }
@@ -999,18 +1746,165 @@ void malloc_error(int tracenum, int opnum, char *msg)
     printf("ERROR [trace %d, line %d]: %s\n", tracenum, LINENUM(opnum), msg);
 }
 
+/*
+ * printthp - prints the throughput of mm malloc on every trace with
+ *     normal pages and with transparent huge pages
+ */
+static void printthp(int n, stats_t *stats, int thp)
+{
+    int i;
+    double secs = 0, thp_secs = 0, ops = 0;
+
+    printf("Results for mm malloc with transparent huge pages:\n");
+    if (!thp)
+	printf("(huge pages are unavailable, both runs use normal pages)\n");
+    printf("%5s%8s%10s%10s%9s\n", "trace", "ops", "Kops", "THP Kops", "speedup");
+    for (i=0; i < n; i++) {
+	if (!stats[i].valid) {
+	    printf("%2d%11s%10s%10s%9s\n", i, "-", "-", "-", "-");
+	    continue;
+	}
+	printf("%2d%11.0f%10.0f%10.0f%9.2f\n",
+	       i,
+	       stats[i].ops,
+	       (stats[i].ops/1e3)/stats[i].secs,
+	       (stats[i].ops/1e3)/stats[i].thp_secs,
+	       stats[i].secs/stats[i].thp_secs);
+	secs += stats[i].secs;
+	thp_secs += stats[i].thp_secs;
+	ops += stats[i].ops;
+    }
+    if (errors == 0 && secs > 0)
+	printf("%-5s%8.0f%10.0f%10.0f%9.2f\n",
+	       "Total",
+	       ops,
+	       (ops/1e3)/secs,
+	       (ops/1e3)/thp_secs,
+	       secs/thp_secs);
+}
+
+/*
+ * set_policy - use fit policy and insertion order pair p of mm malloc,
+ *     p < 0 restores the default (first/lifo)
+ */
+static void set_policy(int p)
+{
+    if (p < 0)
+	p = 0;
+    mm_set_policy(policy_fit[p], policy_order[p]);
+}
+
+/*
+ * set_split - use split threshold p of mm malloc, p < 0 restores the
+ *     default MM_SPLIT_DEFAULT
+ */
+static void set_split(int p)
+{
+    mm_set_split(p < 0 ? MM_SPLIT_DEFAULT : split_sizes[p]);
+}
+
+/*
+ * evalconfigs - run every trace under each of the count configurations
+ *     of mm malloc chosen by set and print the results side by side.
+ *     The default configuration is restored afterwards.
+ */
+static void evalconfigs(char **tracefiles, int n, int count, char **names,
+			char *what, void (*set)(int))
+{
+    int i, p;
+    trace_t *trace;
+    range_t *ranges = NULL;
+    speed_t speed_params;
+    stats_t **stats;
+
+    if ((stats = (stats_t **)calloc(count, sizeof(stats_t *))) == NULL)
+	unix_error("stats calloc in evalconfigs failed");
+    for (p = 0; p < count; p++) {
+	if (verbose > 1)
+	    printf("\nTesting mm malloc with %s %s\n", what, names[p]);
+	if ((stats[p] = (stats_t *)calloc(n, sizeof(stats_t))) == NULL)
+	    unix_error("stats calloc in evalconfigs failed");
+	set(p);
+	for (i=0; i < n; i++) {
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    stats[p][i].ops = trace->num_ops;
+	    stats[p][i].valid = eval_mm_valid(trace, i, &ranges);
+	    if (stats[p][i].valid) {
+		stats[p][i].util = eval_mm_util(trace, i, &ranges);
+		speed_params.trace = trace;
+		speed_params.ranges = ranges;
+		stats[p][i].secs = fsecs(eval_mm_speed, &speed_params);
+	    }
+	    free_trace(trace);
+	}
+    }
+    set(-1);
+    printconfigs(n, count, names, what, stats);
+    for (p = 0; p < count; p++)
+	free(stats[p]);
+    free(stats);
+}
+
+/*
+ * printconfigs - prints the utilization and throughput of mm malloc
+ *     on every trace under each of the count configurations
+ */
+static void printconfigs(int n, int count, char **names, char *what,
+			 stats_t **stats)
+{
+    int i, p;
+    double secs, ops, util;
+
+    printf("Results for mm malloc under every %s (util, Kops):\n", what);
+    printf("%5s", "trace");
+    for (p = 0; p < count; p++)
+	printf("%13s", names[p]);
+    printf("\n");
+    for (i=0; i < n; i++) {
+	printf("%2d   ", i);
+	for (p = 0; p < count; p++) {
+	    if (stats[p][i].valid)
+		printf("%5.0f%%%7.0f", stats[p][i].util * 100.0,
+		       (stats[p][i].ops/1e3)/stats[p][i].secs);
+	    else
+		printf("%13s", "-");
+	}
+	printf("\n");
+    }
+    printf("%-5s", "Total");
+    for (p = 0; p < count; p++) {
+	secs = ops = util = 0;
+	for (i=0; i < n; i++) {
+	    if (!stats[p][i].valid)
+		break;
+	    secs += stats[p][i].secs;
+	    ops += stats[p][i].ops;
+	    util += stats[p][i].util;
+	}
+	if (i < n)
+	    printf("%13s", "-");
+	else
+	    printf("%5.0f%%%7.0f", util/n * 100.0, (ops/1e3)/secs);
+    }
+    printf("\n");
+}
+
 /* 
  * usage - Explain the command line arguments
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hvValHPS] [-f <file>] [-t <dir>] [-m <MB>]\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-a         Don't check the team structure.\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-H         Compare throughput with transparent huge pages.\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-m <MB>    Maximum heap size (default MEM_MAX_HEAP or %d).\n", MAX_HEAP >> 20);
+    fprintf(stderr, "\t-P         Compare the fit policies of mm malloc.\n");
+    fprintf(stderr, "\t-S         Compare the split thresholds of mm malloc.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
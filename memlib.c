@@ -3,6 +3,7 @@
  *            allows us to interleave calls from the student's malloc package 
  *            with the system's malloc package in libc.
  */
+#define _GNU_SOURCE       /* for mremap */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -14,24 +15,94 @@
 #include "memlib.h"
 #include "config.h"
 
+/* size of a transparent huge page, heaps asking for huge pages are aligned to it */
+#define HUGE_PAGE (1 << 21)
+
+/* pages are committed in units of COMMIT_CHUNK bytes, they take memory only once touched */
+#define COMMIT_CHUNK HUGE_PAGE
+
+/* a simulated heap */
+struct mem_region {
+    char *start_brk;  /* points to first byte of heap */
+    char *brk;        /* points to last byte of heap */
+    char *max_addr;   /* largest legal heap address */ 
+    char *peak_brk;   /* largest brk since the heap was last reset */
+    char *commit_brk; /* end of the pages backed by memory */
+    char *dirty_brk;  /* pages from here on were not below brk since they were zeroed */
+    int huge;         /* may pages be backed by transparent huge pages? */
+    struct mem_region *next; /* next heap made by mem_region_create */
+};
+
+/* a mapping created by mem_map */
+typedef struct mem_mapping {
+    char *start;               /* first byte of mapping */
+    size_t size;               /* length of mapping in bytes */
+    struct mem_mapping *next;  /* next mapping */
+} mem_mapping_t;
+
 /* private variables */
-static char *mem_start_brk;  /* points to first byte of heap */
-static char *mem_brk;        /* points to last byte of heap */
-static char *mem_max_addr;   /* largest legal heap address */ 
+static mem_region_t mem_default;  /* the heap used by mem_sbrk and friends */
+static mem_region_t *mem_regions; /* every heap made by mem_region_create */
+static mem_mapping_t *mem_maps;   /* every live mapping */
+static size_t mem_mapped;         /* total bytes of live mappings */
+static size_t mem_held;           /* total bytes below the brk of every heap */
+static size_t mem_peak;           /* peak of the size of every heap plus mapped bytes */
+static size_t mem_max_heap;       /* size of every heap, 0 until it is known */
+static int mem_huge;              /* do heaps created afterwards ask for huge pages? */
+static int mem_map_lock;          /* spin lock guarding the variables above */
+
+static void mem_lock(void);
+static void mem_unlock(void);
+static void mem_update_peak(void);
+static void mem_region_decommit(mem_region_t *r, char *addr);
+static int mem_thp_available(void);
+
+/* 
+ * mem_region_init - reserve the address range used to model one heap,
+ *    pages are committed only when the brk pointer passes them
+ */
+static int mem_region_init(mem_region_t *r)
+{
+    size_t size = mem_max_heapsize();
+    size_t slack = mem_huge ? HUGE_PAGE : 0;
+    char *p, *start;
+
+    /* reserve the storage we will use to model the available VM */
+    p = mmap(NULL, size + slack, PROT_NONE,
+	     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED)
+	return -1;
+
+    /* a huge page heap starts at a huge page boundary, the slack around it is unmapped */
+    start = mem_huge ? (char *)(((size_t)p + HUGE_PAGE - 1) & ~(size_t)(HUGE_PAGE - 1)) : p;
+    if (start > p)
+	munmap(p, start - p);
+    if (p + slack > start)
+	munmap(start + size, p + slack - start);
+    r->start_brk = start;
+    r->huge = 0;
+#ifdef MADV_HUGEPAGE
+    if (mem_huge && mem_thp_available())
+	r->huge = madvise(start, size, MADV_HUGEPAGE) == 0;
+#endif
+
+    r->max_addr = r->start_brk + size;      /* max legal heap address */
+    r->brk = r->start_brk;                  /* heap is empty initially */
+    r->peak_brk = r->start_brk;
+    r->commit_brk = r->start_brk;
+    r->dirty_brk = r->start_brk;
+    return 0;
+}
 
 /* 
  * mem_init - initialize the memory system model
  */
 void mem_init(void)
 {
-    /* allocate the storage we will use to model the available VM */
-    if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
-	fprintf(stderr, "mem_init_vm: malloc error\n");
+    if (mem_region_init(&mem_default) < 0) {
+	fprintf(stderr, "mem_init_vm: mmap error\n");
 	exit(1);
     }
-
-    mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
-    mem_brk = mem_start_brk;                  /* heap is empty initially */
 }
 
 /* 
@@ -39,33 +110,38 @@ void mem_init(void)
  */
 void mem_deinit(void)
 {
-    free(mem_start_brk);
+    mem_reset_brk();
+    munmap(mem_default.start_brk, mem_default.max_addr - mem_default.start_brk);
 }
 
 /*
- * mem_reset_brk - reset the simulated brk pointer to make an empty heap
+ * mem_reset_brk - reset the simulated brk pointer to make an empty heap,
+ *    live mappings are released as well
  */
 void mem_reset_brk()
 {
-    mem_brk = mem_start_brk;
+    mem_mapping_t *m;
+
+    mem_region_reset_brk(&mem_default);
+    mem_lock();
+    while ((m = mem_maps) != NULL) {
+	mem_maps = m->next;
+	munmap(m->start, m->size);
+	free(m);
+    }
+    mem_mapped = 0;
+    mem_peak = 0;
+    mem_unlock();
 }
 
 /* 
  * mem_sbrk - simple model of the sbrk function. Extends the heap 
- *    by incr bytes and returns the start address of the new area. In
- *    this model, the heap cannot be shrunk.
+ *    by incr bytes and returns the start address of the new area. A
+ *    negative incr shrinks the heap and returns the old brk.
  */
 void *mem_sbrk(int incr) 
 {
-    char *old_brk = mem_brk;
-
-    if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
-	errno = ENOMEM;
-	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
-	return (void *)-1;
-    }
-    mem_brk += incr;
-    return (void *)old_brk;
+    return mem_region_sbrk(&mem_default, incr);
 }
 
 /*
@@ -73,7 +149,7 @@ void *mem_sbrk(int incr)
  */
 void *mem_heap_lo()
 {
-    return (void *)mem_start_brk;
+    return mem_region_lo(&mem_default);
 }
 
 /* 
@@ -81,7 +157,7 @@ void *mem_heap_lo()
  */
 void *mem_heap_hi()
 {
-    return (void *)(mem_brk - 1);
+    return mem_region_hi(&mem_default);
 }
 
 /*
@@ -89,7 +165,90 @@ void *mem_heap_hi()
  */
 size_t mem_heapsize() 
 {
-    return (size_t)(mem_brk - mem_start_brk);
+    return mem_region_size(&mem_default);
+}
+
+/*
+ * mem_peak_heapsize() - returns the largest heap size in bytes since
+ *    the last mem_reset_brk
+ */
+size_t mem_peak_heapsize()
+{
+    return mem_region_peak_size(&mem_default);
+}
+
+/*
+ * mem_peak_footprint() - returns the largest number of bytes held by the
+ *    heaps and the mappings together since the last mem_reset_brk
+ */
+size_t mem_peak_footprint()
+{
+    size_t peak;
+
+    mem_lock();
+    peak = mem_peak;
+    mem_unlock();
+    return peak;
+}
+
+/*
+ * mem_set_max_heapsize - set the size of heaps created afterwards, it
+ *    overrides the MEM_MAX_HEAP environment variable and MAX_HEAP
+ */
+void mem_set_max_heapsize(size_t size)
+{
+    if (size > MAX_HEAP_LIMIT)
+	size = MAX_HEAP_LIMIT;
+    mem_max_heap = (size + mem_pagesize() - 1) & ~(mem_pagesize() - 1);
+}
+
+/*
+ * mem_max_heapsize - returns the size of heaps in bytes. Unless it is
+ *    set by mem_set_max_heapsize, it is read from the MEM_MAX_HEAP
+ *    environment variable (bytes, with an optional K, M or G suffix),
+ *    MAX_HEAP is the default.
+ */
+size_t mem_max_heapsize()
+{
+    char *env, *end;
+    unsigned long long size;
+
+    if (mem_max_heap != 0)
+	return mem_max_heap;
+    size = MAX_HEAP;
+    if ((env = getenv("MEM_MAX_HEAP")) != NULL) {
+	size = strtoull(env, &end, 10);
+	switch (*end) {
+	case 'g': case 'G': size <<= 10; /* fall through */
+	case 'm': case 'M': size <<= 10; /* fall through */
+	case 'k': case 'K': size <<= 10;
+	}
+	if (size == 0) {
+	    fprintf(stderr, "Invalid MEM_MAX_HEAP %s, using %d\n", env, MAX_HEAP);
+	    size = MAX_HEAP;
+	}
+    }
+    mem_set_max_heapsize(size > MAX_HEAP_LIMIT ? MAX_HEAP_LIMIT : (size_t)size);
+    return mem_max_heap;
+}
+
+/*
+ * mem_set_hugepages - let heaps created afterwards ask for transparent
+ *    huge pages (on != 0) or not
+ */
+void mem_set_hugepages(int on)
+{
+    mem_huge = on;
+}
+
+/*
+ * mem_hugepages - returns 1 if the default heap may be backed by
+ *    transparent huge pages, it is 0 if the system does not support
+ *    them or they are disabled
+ */
+int mem_hugepages()
+{
+    return mem_default.huge;
 }
 
 /*
@@ -99,3 +258,350 @@ size_t mem_pagesize()
 {
     return (size_t)getpagesize();
 }
+
+/*
+ * mem_default_region - return the heap used by mem_sbrk
+ */
+mem_region_t *mem_default_region()
+{
+    return &mem_default;
+}
+
+/*
+ * mem_region_create - create another heap of mem_max_heapsize() bytes,
+ *    which is independent of the default one. Returns NULL on error.
+ */
+mem_region_t *mem_region_create()
+{
+    mem_region_t *r;
+
+    if ((r = (mem_region_t *)malloc(sizeof(mem_region_t))) == NULL)
+	return NULL;
+    if (mem_region_init(r) < 0) {
+	free(r);
+	return NULL;
+    }
+    mem_lock();
+    r->next = mem_regions;
+    mem_regions = r;
+    mem_unlock();
+    return r;
+}
+
+/*
+ * mem_region_destroy - free a heap created by mem_region_create
+ */
+void mem_region_destroy(mem_region_t *r)
+{
+    mem_region_t **p;
+
+    mem_lock();
+    for (p = &mem_regions; *p != r; p = &(*p)->next)
+	;
+    *p = r->next;
+    mem_held -= r->brk - r->start_brk;
+    mem_unlock();
+    munmap(r->start_brk, r->max_addr - r->start_brk);
+    free(r);
+}
+
+/*
+ * mem_region_reset_brk - reset the brk pointer of heap r, its committed
+ *    pages are kept for the next heap
+ */
+void mem_region_reset_brk(mem_region_t *r)
+{
+    mem_lock();
+    mem_held -= r->brk - r->start_brk;
+    mem_unlock();
+    r->brk = r->start_brk;
+    r->peak_brk = r->start_brk;
+}
+
+/*
+ * mem_region_sbrk - mem_sbrk on heap r
+ */
+void *mem_region_sbrk(mem_region_t *r, int incr)
+{
+    char *old_brk = r->brk;
+
+    if ((incr < 0) && (r->brk - r->start_brk < -(long)incr)) {
+	errno = EINVAL;
+	fprintf(stderr, "ERROR: mem_sbrk failed. Heap shrunk below its start...\n");
+	return (void *)-1;
+    }
+    if ((incr > 0) && ((r->brk + incr) > r->max_addr)) {
+	errno = ENOMEM;
+	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
+	return (void *)-1;
+    }
+    if (r->brk + incr > r->commit_brk) {
+	/* commit the pages up to the new brk, at least COMMIT_CHUNK bytes at once */
+	char *commit = (char *)(((size_t)(r->brk + incr) + COMMIT_CHUNK - 1) & ~(COMMIT_CHUNK - 1));
+	if (commit > r->max_addr)
+	    commit = r->max_addr;
+	if (mprotect(r->commit_brk, commit - r->commit_brk, PROT_READ | PROT_WRITE) < 0) {
+	    errno = ENOMEM;
+	    fprintf(stderr, "ERROR: mem_sbrk failed. Cannot commit memory...\n");
+	    return (void *)-1;
+	}
+	r->commit_brk = commit;
+    }
+    r->brk += incr;
+    /* keep COMMIT_CHUNK bytes above brk committed, so a heap oscillating near brk rarely faults */
+    if (incr < 0 && r->commit_brk - r->brk > 2 * COMMIT_CHUNK)
+	mem_region_decommit(r, (char *)(((size_t)r->brk + COMMIT_CHUNK + mem_pagesize() - 1) & ~(mem_pagesize() - 1)));
+    if (r->brk > r->peak_brk)
+	r->peak_brk = r->brk;
+    if (r->brk > r->dirty_brk)
+	r->dirty_brk = r->brk;
+    mem_lock();
+    mem_held += incr;
+    mem_update_peak();
+    mem_unlock();
+    return (void *)old_brk;
+}
+
+/*
+ * mem_region_lo - return address of the first byte of heap r
+ */
+void *mem_region_lo(mem_region_t *r)
+{
+    return (void *)r->start_brk;
+}
+
+/*
+ * mem_region_hi - return address of the last byte of heap r
+ */
+void *mem_region_hi(mem_region_t *r)
+{
+    return (void *)(r->brk - 1);
+}
+
+/*
+ * mem_region_size - return the size of heap r in bytes
+ */
+size_t mem_region_size(mem_region_t *r)
+{
+    return (size_t)(r->brk - r->start_brk);
+}
+
+/*
+ * mem_region_clean - return the first byte of heap r that has not been
+ *    below brk since its page was last zeroed, every byte from there on
+ *    reads as zero once brk passes it. Resetting brk keeps the old
+ *    contents, so this is the largest brk since the pages were committed.
+ */
+void *mem_region_clean(mem_region_t *r)
+{
+    return (void *)r->dirty_brk;
+}
+
+/*
+ * mem_region_capacity - return the largest size of heap r in bytes
+ */
+size_t mem_region_capacity(mem_region_t *r)
+{
+    return (size_t)(r->max_addr - r->start_brk);
+}
+
+/*
+ * mem_region_peak_size - return the largest size of heap r in bytes
+ *    since it was last reset
+ */
+size_t mem_region_peak_size(mem_region_t *r)
+{
+    return (size_t)(r->peak_brk - r->start_brk);
+}
+
+/*
+ * mem_map - create a mapping of size bytes outside of every heap, size
+ *    is rounded up to the page size. Returns the page aligned start of
+ *    the mapping, NULL on error.
+ */
+void *mem_map(size_t size)
+{
+    mem_mapping_t *m;
+    char *p;
+
+    size = (size + mem_pagesize() - 1) & ~(mem_pagesize() - 1);
+    if ((m = (mem_mapping_t *)malloc(sizeof(mem_mapping_t))) == NULL)
+	return NULL;
+    p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+	free(m);
+	return NULL;
+    }
+    m->start = p;
+    m->size = size;
+    mem_lock();
+    m->next = mem_maps;
+    mem_maps = m;
+    mem_mapped += size;
+    mem_update_peak();
+    mem_unlock();
+    return p;
+}
+
+/*
+ * mem_unmap - release the mapping starting at ptr
+ */
+void mem_unmap(void *ptr)
+{
+    mem_mapping_t *m, **prevp;
+
+    mem_lock();
+    for (prevp = &mem_maps; (m = *prevp) != NULL; prevp = &m->next) {
+	if (m->start == (char *)ptr) {
+	    *prevp = m->next;
+	    mem_mapped -= m->size;
+	    break;
+	}
+    }
+    mem_unlock();
+    if (m == NULL)
+	return;
+    munmap(m->start, m->size);
+    free(m);
+}
+
+/*
+ * mem_remap - resize the mapping starting at ptr to size bytes, rounded
+ *    up to the page size. The mapping may move, its content is kept.
+ *    Returns the new start of the mapping, NULL on error.
+ */
+void *mem_remap(void *ptr, size_t size)
+{
+    mem_mapping_t *m;
+    char *p;
+
+    size = (size + mem_pagesize() - 1) & ~(mem_pagesize() - 1);
+    mem_lock();
+    for (m = mem_maps; m != NULL && m->start != (char *)ptr; m = m->next)
+	;
+    mem_unlock();
+    if (m == NULL)
+	return NULL;
+    /* the owner of a mapping is the only one resizing it */
+    p = mremap(m->start, m->size, size, MREMAP_MAYMOVE);
+    if (p == MAP_FAILED)
+	return NULL;
+    mem_lock();
+    m->start = p;
+    mem_mapped += size - m->size;
+    m->size = size;
+    mem_update_peak();
+    mem_unlock();
+    return p;
+}
+
+/*
+ * mem_purge - give the memory of the size bytes starting at lo back to
+ *    the system, lo and size should be multiples of the page size. The
+ *    bytes stay accessible and read as zero afterwards.
+ */
+void mem_purge(void *lo, size_t size)
+{
+    madvise(lo, size, MADV_DONTNEED);
+}
+
+/*
+ * mem_in_region - return 1 if bytes lo..hi lie below the brk of a single
+ *    heap made by mem_region_create
+ */
+int mem_in_region(void *lo, void *hi)
+{
+    mem_region_t *r;
+    int found = 0;
+
+    mem_lock();
+    for (r = mem_regions; r != NULL; r = r->next) {
+	if ((char *)lo >= r->start_brk && (char *)hi < r->brk) {
+	    found = 1;
+	    break;
+	}
+    }
+    mem_unlock();
+    return found;
+}
+
+/*
+ * mem_in_map - return 1 if bytes lo..hi lie inside a single mapping
+ */
+int mem_in_map(void *lo, void *hi)
+{
+    mem_mapping_t *m;
+    int found = 0;
+
+    mem_lock();
+    for (m = mem_maps; m != NULL; m = m->next) {
+	if ((char *)lo >= m->start && (char *)hi < m->start + m->size) {
+	    found = 1;
+	    break;
+	}
+    }
+    mem_unlock();
+    return found;
+}
+
+/*
+ * mem_lock - acquire the spin lock of the mapping and heap lists, they
+ *    may be changed by several threads of the thread-safe malloc package
+ */
+static void mem_lock(void)
+{
+    while (__atomic_test_and_set(&mem_map_lock, __ATOMIC_ACQUIRE))
+	;
+}
+
+/*
+ * mem_unlock - release the spin lock of the mapping list
+ */
+static void mem_unlock(void)
+{
+    __atomic_clear(&mem_map_lock, __ATOMIC_RELEASE);
+}
+
+/*
+ * mem_update_peak - remember the current footprint if it is the largest
+ *    one, caller holds the spin lock
+ */
+static void mem_update_peak(void)
+{
+    size_t size = mem_held + mem_mapped;
+
+    if (size > mem_peak)
+	mem_peak = size;
+}
+
+/*
+ * mem_region_decommit - give the committed pages of heap r from addr on
+ *    back to the system, they read as zero once they are committed again
+ */
+static void mem_region_decommit(mem_region_t *r, char *addr)
+{
+    if (addr >= r->commit_brk)
+	return;
+    madvise(addr, r->commit_brk - addr, MADV_DONTNEED);
+    mprotect(addr, r->commit_brk - addr, PROT_NONE);
+    r->commit_brk = addr;
+    if (r->dirty_brk > addr)
+	r->dirty_brk = addr;
+}
+
+/*
+ * mem_thp_available - return 1 unless transparent huge pages are missing
+ *    from the kernel or disabled by the system administrator
+ */
+static int mem_thp_available(void)
+{
+    char buf[64];
+    FILE *fp;
+    int ok;
+
+    if ((fp = fopen("/sys/kernel/mm/transparent_hugepage/enabled", "r")) == NULL)
+	return 0;
+    ok = fgets(buf, sizeof(buf), fp) != NULL && strstr(buf, "[never]") == NULL;
+    fclose(fp);
+    return ok;
+}
@@ -1,5 +1,8 @@
 #include <unistd.h>
 
+/* an independent simulated heap, each region has its own brk pointer */
+typedef struct mem_region mem_region_t;
+
 void mem_init(void);               
 void mem_deinit(void);
 void *mem_sbrk(int incr);
@@ -7,5 +10,31 @@ void mem_reset_brk(void);
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
+size_t mem_peak_heapsize(void);
+size_t mem_peak_footprint(void);
 size_t mem_pagesize(void);
+void mem_set_max_heapsize(size_t size);
+size_t mem_max_heapsize(void);
+void mem_set_hugepages(int on);
+int mem_hugepages(void);
+
+mem_region_t *mem_default_region(void);
+mem_region_t *mem_region_create(void);
+void mem_region_destroy(mem_region_t *r);
+void *mem_region_sbrk(mem_region_t *r, int incr);
+void mem_region_reset_brk(mem_region_t *r);
+void *mem_region_lo(mem_region_t *r);
+void *mem_region_hi(mem_region_t *r);
+size_t mem_region_size(mem_region_t *r);
+size_t mem_region_peak_size(mem_region_t *r);
+size_t mem_region_capacity(mem_region_t *r);
+void *mem_region_clean(mem_region_t *r);
+int mem_in_region(void *lo, void *hi);
+
+/* mappings outside of every heap, for blocks too large for a heap */
+void *mem_map(size_t size);
+void mem_unmap(void *ptr);
+void *mem_remap(void *ptr, size_t size);
+int mem_in_map(void *lo, void *hi);
 
+void mem_purge(void *lo, size_t size);
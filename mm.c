@@ -14,9 +14,11 @@
 #include <assert.h>
 #include <unistd.h>
 #include <string.h>
+#include <time.h>
 
 #include "mm.h"
 #include "memlib.h"
+#include "config.h"
 
 /*********************************************************
  * NOTE TO STUDENTS: Before you do anything else, please
@@ -36,18 +38,89 @@ team_t team = {
 };
 
 #define MIN_UNIT 4
-/* address length(6 Bytes is enough) */
-#define ADD_LEN 8
+/* free list links are 4 Bytes offsets from the first byte of arena */
+#define ADD_LEN 4
 /* single word (4) or double word (8) alignment */
 #define ALIGNMENT 8
-/* max list size 2^{24}(16MB) */
-#define LIST_SIZE 25
+/* every power of two size range is split into 2^{SL_SHIFT} linear bins */
+#define SL_SHIFT 4
+#define SL_COUNT (1 << SL_SHIFT)
+/* blocks smaller than SMALL_BLOCK are binned linearly with 8 Bytes per bin */
+#define FL_SHIFT (SL_SHIFT + 3)
+#define SMALL_BLOCK (1 << FL_SHIFT)
+/* block size is stored in 32 bits, so first level index is at most 31 - FL_SHIFT + 1 */
+#define FL_COUNT (32 - FL_SHIFT + 1)
+/* number of blocks examined in the exact bin by first fit before falling back to a larger bin */
+#define FIT_SCAN 8
+/* default fit policy and insertion order of the segregated lists, see mm_set_policy */
+#ifndef MM_FIT
+#define MM_FIT MM_FIRST_FIT
+#endif
+#ifndef MM_ORDER
+#define MM_ORDER MM_LIFO
+#endif
+/* default split threshold, blocks of at least MM_SPLIT Bytes are carved from the end of free blocks, see mm_set_split */
+#ifndef MM_SPLIT
+#define MM_SPLIT MM_SPLIT_DEFAULT
+#endif
+/* free blocks of at least TREE_MIN Bytes are kept in a bitwise trie per first level class instead of lists */
+#define TREE_SHIFT 10
+#define TREE_MIN (1 << TREE_SHIFT)
+#define TREE_FL (TREE_SHIFT - FL_SHIFT + 1)
+/* parent of a trie root, blocks chained behind a trie node of the same size have parent NULL_ADD */
+#define TREE_ROOT 1
 /* minimum request block size */
 #define MIN_CHUNK 1 << 12
-/* every block(allocated/freed) should be larger than 24 Bytes */
-#define MIN_BLOCK 24
-/* illegal address */
+/* free block at the top of heap larger than TRIM_THRESHOLD Bytes is shrunk to TRIM_PAD Bytes */
+#define TRIM_THRESHOLD (1 << 17)
+#define TRIM_PAD (1 << 16)
+/* requests of at least MMAP_THRESHOLD Bytes are served by their own mappings */
+#define MMAP_THRESHOLD (1 << 18)
+/* the 8 Bytes before a mapped block hold the length of its mapping, the block starts in the first page */
+#define MAP_HEAD 8
+/* largest payload of a mapped block, its length with a head of at most a page is rounded up without wrapping around */
+#define MAP_MAX ((size_t)-1 - 2 * mem_pagesize())
+/* first byte of the mapping of mapped block @param: ptr */
+#define MAP_BASE(ptr) ((char*)(((size_t)(ptr) - MAP_HEAD) & ~(mem_pagesize() - 1)))
+/* interior pages of free blocks of at least PURGE_MIN Bytes are purged */
+#define PURGE_MIN (1 << 13)
+/*
+ * lazy purging (-DMM_PURGE_DECAY=<ms>): a free block that stays free for a whole
+ * decay period is purged by a later free, the clock is read once every PURGE_TICK frees
+ */
+#ifndef MM_PURGE_DECAY
+#define MM_PURGE_DECAY 0
+#endif
+#define PURGE_TICK 256
+/* stamp of a purged free block */
+#define PURGED (~0U)
+/* every block(allocated/freed) should be larger than 16 Bytes(header, pre, succ, footer) */
+#define MIN_BLOCK 16
+/* illegal address, offset 0 is the prologue block which is never free */
 #define NULL_ADD 0
+/* requests smaller than SLAB_MAX Bytes are served by slab pages */
+#define SLAB_MAX 64
+/* one slab class per 8 Bytes slot size */
+#define SLAB_CLASSES (SLAB_MAX >> 3)
+/* slab page size, slab pages are aligned to SLAB_PAGE relative to the heap */
+#define SLAB_SHIFT 12
+#define SLAB_PAGE (1 << SLAB_SHIFT)
+/* upper bound of slots in a slab page, used to size the free bitmap */
+#define SLAB_WORDS (SLAB_PAGE / 8 / 32)
+/* freed blocks of at most QUICK_MAX Bytes stay allocated on quick lists of their exact size */
+#define QUICK_MAX 512
+#define QUICK_CLASSES (QUICK_MAX >> 3)
+/* chunks of bump allocators(mm_arena_t) are blocks of BUMP_CHUNK Bytes, the first 8 Bytes link the chunk before */
+#define BUMP_CHUNK ((1 << 16) - MIN_UNIT)
+#define BUMP_HEAD 8
+/* requests larger than BUMP_BIG Bytes get a chunk of their own */
+#define BUMP_BIG (BUMP_CHUNK >> 2)
+/* chunks released by one mm_free_batch call */
+#define BUMP_BATCH 32
+/* header bit of an allocated block grown by realloc, its last word keeps the payload Bytes in use */
+#define GROWN 0x4
+/* a block grown again reserves 1 / 2^{GROW_SHIFT} of its size as slack */
+#define GROW_SHIFT 2
 
 /* get block size from header */
 #define BLOCK_SIZE(header) (*(UI*)(header) & ~0x7)
@@ -59,116 +132,1297 @@ team_t team = {
 #define GET_FOOTER(header) ((header) + BLOCK_SIZE(header) - MIN_UNIT)
 /* rebuild block's header and footer */
 #define REBUILD_HF(header, size) (NEW_SIZE(header, size), PACK(GET_FOOTER(header), (size), (*(UI*)(header) & 0x2) >> 1, *(UI*)(header) & 0x1))
+/* set(clear) pre block allocation bit of next block @param: header, whose owner may read it by block_class without lock */
+#define SET_PRE(header) __atomic_store_n((UI*)(header), *(UI*)(header) | 2, __ATOMIC_RELAXED)
+#define CLEAR_PRE(header) __atomic_store_n((UI*)(header), *(UI*)(header) & ~2, __ATOMIC_RELAXED)
+/* free list links of a free block, offsets relative to arena */
+#define PRED(header) (*(UI*)((header) + MIN_UNIT))
+#define SUCC(header) (*(UI*)((header) + MIN_UNIT + ADD_LEN))
+/* convert between address and offset relative to arena @param: a */
+#define TO_OFF(a, p) ((UI)((char*)(p) - (a)->lo))
+#define TO_PTR(a, off) ((void*)((a)->lo + (off)))
+/* is arena @param: a a heap made by mm_heap_create rather than an arena of the default heap */
+#define PRIVATE(a) ((a) < arenas || (a) >= arenas + ARENA_COUNT)
+/* heap below @param: p is no longer known to be zero */
+#define DIRTY(a, p) ((a)->fresh = TO_OFF(a, p) > (a)->fresh ? TO_OFF(a, p) : (a)->fresh)
 /* rounds up to the nearest multiple of ALIGNMENT */
 #define ALIGN(size) (((size) + (ALIGNMENT-1)) & ~0x7)
+/* payload Bytes in use of a grown block */
+#define GROWN_USED(header) (*(UI*)GET_FOOTER(header))
+/* rounds up to the nearest multiple of page size */
+#define PAGE_ALIGN(size) (((size) + mem_pagesize() - 1) & ~(mem_pagesize() - 1))
+/* decay period a free block(at least PURGE_MIN Bytes) was linked in, stored after its links */
+#define STAMP(header) (*(UI*)((header) + MIN_UNIT + 2 * ADD_LEN))
+/* next block of a quick list, offset stored in the first word of payload */
+#define QUICK_NEXT(header) PRED(header)
+/* trie links of a free block(at least TREE_MIN Bytes), stored after its stamp */
+#define CHILD(header, i) (*(UI*)((header) + MIN_UNIT + (3 + (i)) * ADD_LEN))
+#define PARENT(header) (*(UI*)((header) + MIN_UNIT + 5 * ADD_LEN))
+/* Bytes at the beginning of a trie block holding header and links */
+#define TREE_HEAD (MIN_UNIT + 6 * ADD_LEN)
 
 typedef unsigned long long ULL;
 typedef unsigned int UI;
 
-/* segregated list */
-static ULL list[LIST_SIZE];
-/* points to the first block of heap */
-static char* heapp;
+/*
+ * thread-safe build (-DMM_THREADS): the heap is split into MM_ARENAS arenas,
+ * each guarded by its own lock, threads are assigned to arenas round-robin;
+ * every thread also keeps a small cache of recently freed blocks per size class;
+ * blocks freed by a thread of another arena are pushed to a lock-free queue of
+ * their arena and released by the next allocation in that arena
+ */
+#ifdef MM_THREADS
+#include <pthread.h>
+/* number of arenas, every arena owns a memlib region */
+#ifndef MM_ARENAS
+#define MM_ARENAS 8
+#endif
+#define ARENA_COUNT MM_ARENAS
+/* requests up to CACHE_MAX Bytes are served by per-thread caches */
+#define CACHE_MAX 512
+/* one cache class per 8 Bytes of slot(slab) or block(segregated list) size */
+#define CACHE_CLASSES (ALIGN(CACHE_MAX + MIN_UNIT) >> 3)
+/* maximum number of blocks cached per class */
+#define CACHE_COUNT 32
+/* number of blocks moved between cache and heap at once */
+#define CACHE_BATCH 16
+#define LOCK(a) pthread_mutex_lock(&(a)->lock)
+#define UNLOCK(a) pthread_mutex_unlock(&(a)->lock)
+#else
+#define ARENA_COUNT 1
+#define LOCK(a)
+#define UNLOCK(a)
+#endif
+
+/* slab page header, placed at the first byte of every slab page */
+typedef struct {
+    ULL pre;                    /* previous slab page of same class with free slots */
+    ULL succ;                   /* next slab page of same class with free slots */
+    UI slot;                    /* slot size in Bytes */
+    UI used;                    /* number of allocated slots */
+    UI free_map[SLAB_WORDS];    /* bit set iff slot is free */
+} slab_t;
+
+/* offset of the first slot in a slab page */
+#define SLAB_HEAD ALIGN(sizeof(slab_t))
+
+/*
+ * an arena is an independent heap in its own memlib region; the default heap is made of
+ * the arenas of arenas[], a heap created by mm_heap_create is a single arena whose state
+ * lives at the bottom of its own region
+ */
+typedef struct mm_heap {
+    /* set once arena is initialized and may be used by any thread */
+    int ready;
+    /* memlib region of this arena */
+    mem_region_t* region;
+    /* first byte of region */
+    char* lo;
+    /* size of region, the heap never grows past it */
+    size_t cap;
+    /* points to the first block of heap */
+    char* heapp;
+    /* segregated list, list[fl][sl] holds free blocks of a two-level size class below TREE_MIN */
+    UI list[TREE_FL][SL_COUNT];
+    /* root of the size trie of every first level class from TREE_FL on */
+    UI tree[FL_COUNT];
+    /* bit fl is set iff sl_map[fl] is non-zero(list classes) or tree[fl] is non-empty(trie classes) */
+    UI fl_map;
+    /* bit sl of sl_map[fl] is set iff list[fl][sl] is non-empty */
+    UI sl_map[TREE_FL];
+    /* roving pointer of every list, next fit resumes from it */
+    UI rover[TREE_FL][SL_COUNT];
+    /* quick lists, quick[i] holds freed blocks of (i + 1) * 8 Bytes that are still marked allocated */
+    UI quick[QUICK_CLASSES];
+    /* bit i is set iff quick[i] is non-empty */
+    ULL quick_map;
+    /* slab pages with free slots of every slab class */
+    ULL slabs[SLAB_CLASSES];
+    /* bit i is set iff i-th page of heap is a slab page, only the words covering cap are used */
+    UI slab_map[MAX_HEAP_LIMIT / SLAB_PAGE / 32];
+    /* unused Bytes reserved by grown blocks */
+    UI slack;
+    /* heap from offset fresh on was never handed out since its pages were zero, it only
+       holds the links and footer of the free block covering it */
+    UI fresh;
+    /* next heap made by mm_heap_create, unused by the arenas of the default heap */
+    struct mm_heap* next;
+    /* current decay period, large free blocks are stamped with the period they were freed in */
+    UI epoch;
+#if MM_PURGE_DECAY
+    /* time(ms) current decay period began */
+    long long epoch_start;
+    /* frees since the clock was read */
+    UI frees;
+#endif
+#ifdef MM_THREADS
+    pthread_mutex_t lock;
+    /* blocks freed by other threads, linked through the first word of payload */
+    void* remote;
+#endif
+} arena_t;
+
+/* bump allocator, lives at the beginning of its first chunk */
+struct mm_arena {
+    char* chunk;    /* newest chunk */
+    char* cur;      /* next free byte of newest chunk */
+    char* end;      /* end of newest chunk */
+};
+
+static arena_t arenas[ARENA_COUNT];
+/* heaps made by mm_heap_create, searched by arena_of for pointers outside the default heap */
+static arena_t* heaps;
+/* fit policy and insertion order of the segregated lists */
+static int fit_policy = MM_FIT;
+static int order_policy = MM_ORDER;
+/* blocks of at least split_size Bytes are carved from the end of free blocks, 0 disables it */
+static size_t split_size = MM_SPLIT;
+#ifdef MM_THREADS
+/* arena of current thread, assigned on first allocation */
+static __thread arena_t* thread_arena;
+/* next arena to assign */
+static UI arena_next;
+/* serializes arena initialization and changes of heaps */
+static pthread_mutex_t arena_lock = PTHREAD_MUTEX_INITIALIZER;
+/* cached blocks of every class, linked through the first 8 Bytes of payload */
+static __thread ULL cache[CACHE_CLASSES];
+static __thread UI cache_count[CACHE_CLASSES];
+/* set once cache destructor of current thread is registered */
+static __thread int cache_registered;
+static pthread_key_t cache_key;
+static pthread_once_t cache_once = PTHREAD_ONCE_INIT;
+#endif
 static char* end;
-/* arrays used by high_bit */
-const static UI b[] = {0x2, 0xc, 0xf0, 0xff00, 0xffff0000};
-const static int s[] = {1, 2, 4, 8, 16};
 /* helper functions */
 static int high_bit(UI val);
-static void* extend_heap(size_t size);
-static void* coalesce(void* header);
-static void detach_off(void* header);
-static void* allocate_block(void* header, size_t size);
-static void split_block(void* header, UI block_size);
-static void link_to_list(void* header);
+static void mapping(UI size, int* fl, int* sl);
+static int arena_init(arena_t* a, mem_region_t* region);
+static arena_t* arena_of(void* ptr);
+static arena_t* my_arena(void);
+static void* find_fit(arena_t* a, UI size);
+static void* list_fit(arena_t* a, int fl, int sl, UI size);
+static void* extend_heap(arena_t* a, size_t size);
+static void* coalesce(arena_t* a, void* header);
+static void detach_off(arena_t* a, void* header);
+static void* allocate_block(arena_t* a, void* header, size_t size);
+static void* allocate_tail(arena_t* a, void* header, UI size);
+static void split_block(arena_t* a, void* header, UI block_size);
+static void link_to_list(arena_t* a, void* header);
+static void* tree_fit(arena_t* a, UI size);
+static void tree_insert(arena_t* a, void* header);
+static void tree_remove(arena_t* a, void* header);
+static int purge_block(arena_t* a, char* header, int lazy);
+static void* allocate_aligned(arena_t* a, UI align, UI size);
+static void* slab_alloc(arena_t* a, size_t size);
+static void slab_free(arena_t* a, void* ptr);
+static slab_t* slab_page(arena_t* a, void* ptr);
+static void* heap_malloc(arena_t* a, size_t size);
+static void* heap_malloc_hint(arena_t* a, size_t size, int hint);
+static void* heap_calloc(arena_t* a, size_t size);
+static void* find_block(arena_t* a, UI size);
+static void clear_block(arena_t* a, void* header, UI fresh, size_t size);
+static size_t heap_malloc_batch(arena_t* a, size_t size, size_t n, void** out);
+static size_t merge_run(arena_t* a, void** ptrs, size_t i, size_t n);
+static int ptr_cmp(const void* x, const void* y);
+static void heap_free(arena_t* a, void* ptr);
+static void* release_block(arena_t* a, void* header);
+static void quick_push(arena_t* a, void* header, UI size);
+static void quick_flush(arena_t* a);
+static void* heap_realloc(arena_t* a, void* ptr, size_t size);
+static void* grow_block(arena_t* a, void* header, UI size);
+static UI grown_slack(void* header);
+static int reclaim_slack(arena_t* a);
+static void trim_heap(arena_t* a, void* header);
+static UI heap_usable(arena_t* a, void* ptr);
+static void* map_alloc(size_t size, size_t align);
+static void map_free(void* ptr);
+static void* map_realloc(void* ptr, size_t size);
+static int purge_arena(arena_t* a, int lazy);
+#if MM_PURGE_DECAY
+static void decay_purge(arena_t* a);
+static long long now_ms(void);
+#endif
+#ifdef MM_THREADS
+static int cache_class(size_t size);
+static int block_class(arena_t* a, void* ptr);
+static void* cache_alloc(int cls, size_t size);
+static void cache_free(int cls, void* ptr);
+static void cache_flush(int cls, UI count);
+static void cache_register(void);
+static void cache_destroy(void* arg);
+static void cache_key_init(void);
+static void remote_free(arena_t* a, void* ptr);
+static void remote_drain(arena_t* a);
+#endif
 int a_hits = 0;
 int f_hits = 0;
 
 /**
  * mm_init - initialize the malloc package.
+ * the first arena lives in the default memlib region, other arenas(thread-safe build)
+ * are created on demand and emptied here, mm_init should not race with other calls
+*/
+int mm_init(void)
+{
+    int i;
+    if (arena_init(&arenas[0], mem_default_region()) < 0) return -1;
+    arenas[0].ready = 1;
+    for (i = 1; i < ARENA_COUNT; i++) {
+        if (!arenas[i].ready) continue;
+        mem_region_reset_brk(arenas[i].region);
+        if (arena_init(&arenas[i], arenas[i].region) < 0) return -1;
+    }
+#ifdef MM_THREADS
+    // blocks cached by current thread belong to the old heap
+    for (i = 0; i < CACHE_CLASSES; i++) {
+        cache[i] = NULL_ADD;
+        cache_count[i] = 0;
+    }
+#endif
+    return 0;
+}
+
+/**
+ * mm_malloc - Allocate a block with at least @param: size Bytes payload.
+ *     Always allocate a block whose size is a multiple of the alignment.
+*/
+void *mm_malloc(size_t size)
+{
+    return mm_heap_malloc(arenas, size);
+}
+
+/*
+ * mm_free - Free a block returned by mm_malloc or mm_realloc.
+ */
+void mm_free(void *ptr)
+{
+    mm_heap_free(arenas, ptr);
+}
+
+/*
+ * mm_realloc - Resize a block, data is preserved up to the smaller size.
+ */
+void *mm_realloc(void *ptr, size_t size)
+{
+    return mm_heap_realloc(arenas, ptr, size);
+}
+
+/**
+ * mm_set_split - carve blocks of at least @param: threshold Bytes(header included) from the
+ * end of free blocks and smaller ones from the beginning, so blocks of similar size are
+ * clustered and free neighbours coalesce more often; 0 carves every block from the beginning
+ * @return previous threshold
+*/
+size_t mm_set_split(size_t threshold)
+{
+    size_t old = split_size;
+    split_size = threshold;
+    return old;
+}
+
+/**
+ * mm_heap_default - @return handle of the heap behind mm_malloc, mm_free and mm_realloc
+*/
+mm_heap_t *mm_heap_default(void)
+{
+    return arenas;
+}
+
+/**
+ * mm_heap_create - create a heap in a memlib region of its own, with its own free lists
+ * and lock; its blocks are freed or resized through it or by the functions that only take
+ * a pointer, huge blocks are taken from its region too, so mm_heap_destroy gives back every
+ * block at once
+ * @return NULL if no region is left
+*/
+mm_heap_t *mm_heap_create(void)
+{
+    mem_region_t* region = mem_region_create();
+    if (region == NULL) return NULL;
+    arena_t* h = mem_region_sbrk(region, ALIGN(sizeof(arena_t)));
+    if (h == (void*)-1 || arena_init(h, region) < 0) {
+        mem_region_destroy(region);
+        return NULL;
+    }
+    h->ready = 1;
+    // never published in arenas[], arena_of finds its blocks through heaps
+#ifdef MM_THREADS
+    pthread_mutex_lock(&arena_lock);
+#endif
+    h->next = heaps;
+    __atomic_store_n(&heaps, h, __ATOMIC_RELEASE);
+#ifdef MM_THREADS
+    pthread_mutex_unlock(&arena_lock);
+#endif
+    return h;
+}
+
+/**
+ * mm_heap_destroy - release heap @param: h with all of its blocks, @param: h is not the default heap
+*/
+void mm_heap_destroy(mm_heap_t *h)
+{
+    arena_t** p;
+#ifdef MM_THREADS
+    pthread_mutex_lock(&arena_lock);
+#endif
+    for (p = &heaps; *p != h; p = &(*p)->next);
+    __atomic_store_n(p, h->next, __ATOMIC_RELEASE);
+#ifdef MM_THREADS
+    pthread_mutex_unlock(&arena_lock);
+    pthread_mutex_destroy(&h->lock);
+#endif
+    // state of heap is inside its region
+    mem_region_destroy(h->region);
+}
+
+/**
+ * mm_heap_malloc - mm_malloc on heap @param: h
+*/
+void *mm_heap_malloc(mm_heap_t *h, size_t size)
+{
+    if (size == 0) return NULL;
+    void* ptr;
+    if (h != arenas) {
+        if (size >= h->cap) return NULL;
+        LOCK(h);
+        ptr = heap_malloc(h, size);
+        UNLOCK(h);
+        return ptr;
+    }
+    // huge requests bypass arenas
+    if (size >= MMAP_THRESHOLD) return map_alloc(size, ALIGNMENT);
+#ifdef MM_THREADS
+    int cls = cache_class(size);
+    if (cls >= 0) return cache_alloc(cls, size);
+#endif
+    arena_t* a = my_arena();
+    LOCK(a);
+#ifdef MM_THREADS
+    remote_drain(a);
+#endif
+    ptr = heap_malloc(a, size);
+    UNLOCK(a);
+    return ptr;
+}
+
+/**
+ * mm_heap_free - mm_free on heap @param: h, @param: ptr was allocated from @param: h
+*/
+void mm_heap_free(mm_heap_t *h, void *ptr)
+{
+    if (ptr == NULL) return;
+    arena_t* a = h != arenas ? h : arena_of(ptr);
+    if (a == NULL) {
+        map_free(ptr);
+        return;
+    }
+    // private heaps have no thread caches
+    if (PRIVATE(a)) {
+        LOCK(a);
+        heap_free(a, ptr);
+        UNLOCK(a);
+        return;
+    }
+#ifdef MM_THREADS
+    int cls = block_class(a, ptr);
+    if (cls >= 0) {
+        cache_free(cls, ptr);
+        return;
+    }
+    // never block on lock of another arena
+    if (a != thread_arena) {
+        remote_free(a, ptr);
+        return;
+    }
+#endif
+    LOCK(a);
+    heap_free(a, ptr);
+    UNLOCK(a);
+}
+
+/**
+ * mm_calloc - allocate zeroed payload for @param: nmemb elements of @param: size Bytes
+ * only the part of a block that was used before is cleared, blocks carved from heap
+ * which was never handed out and fresh mappings are already zero
+ * @return NULL if the total size overflows, exceeds MAP_MAX or memory runs out
+*/
+void *mm_calloc(size_t nmemb, size_t size)
+{
+    if (nmemb == 0 || size == 0) return NULL;
+    if (nmemb > (size_t)-1 / size) return NULL;
+    size *= nmemb;
+    if (size > MAP_MAX) return NULL;
+    if (size >= MMAP_THRESHOLD) return map_alloc(size, ALIGNMENT);
+    void* ptr;
+#ifdef MM_THREADS
+    int cls = cache_class(size);
+    if (cls >= 0) {
+        if ((ptr = cache_alloc(cls, size)) != NULL) memset(ptr, 0, size);
+        return ptr;
+    }
+#endif
+    arena_t* a = my_arena();
+    LOCK(a);
+#ifdef MM_THREADS
+    remote_drain(a);
+#endif
+    ptr = heap_calloc(a, size);
+    UNLOCK(a);
+    return ptr;
+}
+
+/**
+ * mm_free_sized - free block @param: ptr whose size is known to caller
+ * @param: size is the size the block was last allocated or reallocated with, or any size
+ * up to mm_usable_size(@param: ptr); a block small enough for quick lists(thread caches)
+ * is pushed to the list of @param: size without reading its header, which is only
+ * checked in debug builds
+*/
+void mm_free_sized(void *ptr, size_t size)
+{
+    UI bsize = ALIGN(size + MIN_UNIT);
+    // slots(up to SLAB_MAX Bytes) can't be told from shrunk blocks by size, larger blocks may be grown or mapped
+    if (ptr == NULL || size <= SLAB_MAX || bsize > QUICK_MAX) {
+        mm_free(ptr);
+        return;
+    }
+    arena_t* a = arena_of(ptr);
+    if (a == NULL || PRIVATE(a)) {
+        mm_free(ptr);
+        return;
+    }
+    void* header = ptr - MIN_UNIT;
+    // blocks fitting quick lists are never grown, the unsplit tail of a block is less than MIN_BLOCK
+    assert(slab_page(a, ptr) == NULL);
+    assert(!(*(UI*)header & GROWN) && BLOCK_SIZE(header) >= bsize && BLOCK_SIZE(header) < bsize + MIN_BLOCK);
+#ifdef MM_THREADS
+    cache_free(cache_class(size), ptr);
+#else
+    quick_push(a, header, bsize);
+#endif
+}
+
+/**
+ * mm_usable_size - @return Bytes of payload block @param: ptr may hold, at least the size
+ * it was allocated with; spare Bytes of a block grown by realloc are handed to caller
+ * and no longer given back to heap
+*/
+size_t mm_usable_size(void *ptr)
+{
+    if (ptr == NULL) return 0;
+    arena_t* a = arena_of(ptr);
+    // mapping ends at the end of its last page
+    assert(a != NULL || mem_in_map(ptr, ptr));
+    if (a == NULL) return *(ULL*)((char*)ptr - MAP_HEAD) - ((char*)ptr - MAP_BASE(ptr));
+    slab_t* page = slab_page(a, ptr);
+    if (page != NULL) return page->slot;
+    void* header = ptr - MIN_UNIT;
+    if (!(*(UI*)header & GROWN)) return BLOCK_SIZE(header) - MIN_UNIT;
+    // slack of grown blocks may be reclaimed by any thread of the arena
+    LOCK(a);
+    size_t size = BLOCK_SIZE(header) - MIN_UNIT;
+    if (*(UI*)header & GROWN) {
+        a->slack -= grown_slack(header);
+        // last word still keeps the size in use
+        size -= MIN_UNIT;
+        GROWN_USED(header) = size;
+    }
+    UNLOCK(a);
+    return size;
+}
+
+/*
+ * mm_heap_realloc - mm_realloc on heap @param: h, @param: ptr was allocated from @param: h.
+ *     A moved block stays in the arena of the original block unless it
+ *     moves between a mapping and the heap.
+ */
+void *mm_heap_realloc(mm_heap_t *h, void *ptr, size_t size)
+{
+    if (ptr == NULL) return mm_heap_malloc(h, size);
+    if (size == 0) {
+        mm_heap_free(h, ptr);
+        return NULL;
+    }
+    void* ne_block;
+    arena_t* a = h != arenas ? h : arena_of(ptr);
+    if (a == NULL) return map_realloc(ptr, size);
+    // huge blocks of private heaps stay in their region
+    if (PRIVATE(a)) {
+        if (size >= a->cap) return NULL;
+        LOCK(a);
+        ne_block = heap_realloc(a, ptr, size);
+        UNLOCK(a);
+        return ne_block;
+    }
+    // block growing past MMAP_THRESHOLD moves to its own mapping
+    if (size >= MMAP_THRESHOLD) {
+        if ((ne_block = map_alloc(size, ALIGNMENT)) == NULL) return NULL;
+        LOCK(a);
+        UI used = heap_usable(a, ptr);
+        memcpy(ne_block, ptr, used < size ? used : size);
+        heap_free(a, ptr);
+        UNLOCK(a);
+        return ne_block;
+    }
+    LOCK(a);
+    ne_block = heap_realloc(a, ptr, size);
+    UNLOCK(a);
+    return ne_block;
+}
+
+/**
+ * mm_malloc_hint - mm_malloc with the expected lifetime of the block, MM_SHORT or MM_LONG;
+ * blocks of both classes are carved from opposite ends of free blocks, so short-lived
+ * blocks freed together coalesce instead of being pinned apart by long-lived ones;
+ * the hint overrides mm_set_split, requests served by slab pages, quick lists
+ * (thread caches) or mappings ignore it
+*/
+void *mm_malloc_hint(size_t size, int hint)
+{
+    if (hint != MM_SHORT && hint != MM_LONG) return mm_malloc(size);
+    if (size < SLAB_MAX || size >= MMAP_THRESHOLD) return mm_malloc(size);
+#ifdef MM_THREADS
+    if (cache_class(size) >= 0) return mm_malloc(size);
+#endif
+    arena_t* a = my_arena();
+    LOCK(a);
+#ifdef MM_THREADS
+    remote_drain(a);
+#endif
+    void* ptr = heap_malloc_hint(a, size, hint);
+    UNLOCK(a);
+    return ptr;
+}
+
+/**
+ * mm_memalign - allocate a block with at least @param: size Bytes payload aligned to
+ * @param: alignment Bytes, which should be a power of two; the leading part of the
+ * free block it is carved from is split off as a free block
+ * @return NULL if @param: alignment is not a power of two, the block with its alignment
+ * would not fit MAX_HEAP_LIMIT or memory runs out
+*/
+void *mm_memalign(size_t alignment, size_t size)
+{
+    if (alignment == 0 || (alignment & (alignment - 1))) return NULL;
+    if (alignment <= ALIGNMENT) return mm_malloc(size);
+    if (size == 0) return NULL;
+    // checked before the mapping branch too, written so that it cannot wrap around
+    if (alignment >= MAX_HEAP_LIMIT || size >= MAX_HEAP_LIMIT - alignment - MIN_BLOCK) return NULL;
+    if (size >= MMAP_THRESHOLD && alignment <= mem_pagesize()) return map_alloc(size, alignment);
+    UI bsize = ALIGN(size + MIN_UNIT);
+    if (bsize < MIN_BLOCK) bsize = MIN_BLOCK;
+    arena_t* a = my_arena();
+    LOCK(a);
+#ifdef MM_THREADS
+    remote_drain(a);
+#endif
+    void* header = allocate_aligned(a, alignment, bsize);
+    UNLOCK(a);
+    return header == NULL ? NULL : header + MIN_UNIT;
+}
+
+/**
+ * mm_aligned_alloc - C11 aligned_alloc, same as mm_memalign
+*/
+void *mm_aligned_alloc(size_t alignment, size_t size)
+{
+    return mm_memalign(alignment, size);
+}
+
+/**
+ * mm_malloc_batch - allocate @param: n blocks with at least @param: size Bytes payload each
+ * and store them to @param: out, heap blocks are carved from one free block at a time
+ * @return number of blocks allocated, less than @param: n only if memory runs out
+*/
+size_t mm_malloc_batch(size_t size, size_t n, void** out)
+{
+    size_t i = 0;
+    if (size == 0 || size > MAP_MAX) return 0;
+    if (size >= MMAP_THRESHOLD) {
+        for (; i < n && (out[i] = map_alloc(size, ALIGNMENT)) != NULL; i++);
+        return i;
+    }
+    arena_t* a = my_arena();
+    LOCK(a);
+#ifdef MM_THREADS
+    remote_drain(a);
+#endif
+    i = heap_malloc_batch(a, size, n, out);
+    UNLOCK(a);
+    return i;
+}
+
+/**
+ * mm_free_batch - free @param: n blocks of @param: ptrs, NULL pointers are skipped
+ * @param: ptrs is sorted by address in place, a run of physically adjacent heap blocks
+ * is merged into one block first, so it is coalesced with its neighbours only once
+*/
+void mm_free_batch(void** ptrs, size_t n)
+{
+    size_t i, j;
+    arena_t* locked = NULL;
+    // blocks of one mm_malloc_batch are usually freed in the order they were carved
+    for (i = 1; i < n && ptrs[i - 1] <= ptrs[i]; i++);
+    if (i < n) qsort(ptrs, n, sizeof(void*), ptr_cmp);
+    for (i = 0; i < n; i = j) {
+        void* ptr = ptrs[i];
+        j = i + 1;
+        if (ptr == NULL) continue;
+        arena_t* a = arena_of(ptr);
+        if (a == NULL) {
+            map_free(ptr);
+            continue;
+        }
+#ifdef MM_THREADS
+        // never block on lock of another arena, private heaps have no remote frees
+        if (a != thread_arena && !PRIVATE(a)) {
+            remote_free(a, ptr);
+            continue;
+        }
+#endif
+        if (locked != a) {
+            if (locked != NULL) UNLOCK(locked);
+            LOCK(a);
+            locked = a;
+        }
+        if (slab_page(a, ptr) == NULL) j = merge_run(a, ptrs, i, n);
+        heap_free(a, ptr);
+    }
+    if (locked != NULL) UNLOCK(locked);
+}
+
+/**
+ * mm_trim - give the interior pages of every large free block back to the system,
+ * in the arenas of the default heap and in the heaps made by mm_heap_create
+ * @return 1 if any memory was released, 0 otherwise
+*/
+int mm_trim(void)
+{
+    int i, purged = 0;
+    arena_t* a;
+    for (i = 0; i < ARENA_COUNT; i++) {
+        a = &arenas[i];
+        if (!__atomic_load_n(&a->ready, __ATOMIC_ACQUIRE)) continue;
+        LOCK(a);
+        quick_flush(a);
+        purged |= purge_arena(a, 0);
+        UNLOCK(a);
+    }
+    // arena_lock keeps heaps from being destroyed; a heap lock is usually taken before
+    // arena_lock(mm_free_batch calls arena_of under it), so a busy heap is skipped
+#ifdef MM_THREADS
+    pthread_mutex_lock(&arena_lock);
+#endif
+    for (a = heaps; a != NULL; a = a->next) {
+#ifdef MM_THREADS
+        if (pthread_mutex_trylock(&a->lock) != 0) continue;
+#endif
+        quick_flush(a);
+        purged |= purge_arena(a, 0);
+        UNLOCK(a);
+    }
+#ifdef MM_THREADS
+    pthread_mutex_unlock(&arena_lock);
+#endif
+    return purged;
+}
+
+/**
+ * mm_set_policy - select how free blocks below TREE_MIN Bytes are found and linked,
+ * larger blocks are always best fit by the size tries; call it before mm_init
+ * @param: fit MM_FIRST_FIT, MM_BEST_FIT or MM_NEXT_FIT
+ * @param: order MM_LIFO or MM_ADDR_ORDER
+ * @return 0, or -1 if a policy is unknown
+*/
+int mm_set_policy(int fit, int order)
+{
+    if (fit < MM_FIRST_FIT || fit > MM_NEXT_FIT) return -1;
+    if (order != MM_LIFO && order != MM_ADDR_ORDER) return -1;
+    fit_policy = fit;
+    order_policy = order;
+    return 0;
+}
+
+/**
+ * mm_arena_create - create a bump allocator whose chunks are taken from the default heap
+ * by mm_malloc, objects are never freed one by one but all at once by mm_arena_reset;
+ * an mm_arena_t is not thread-safe and has nothing to do with the arenas of the heap
+ * @return NULL if memory runs out
+*/
+mm_arena_t *mm_arena_create(void)
+{
+    char* chunk = mm_malloc(BUMP_CHUNK);
+    if (chunk == NULL) return NULL;
+    mm_arena_t* ar = (mm_arena_t*)(chunk + BUMP_HEAD);
+    *(char**)chunk = NULL;
+    ar->chunk = chunk;
+    ar->cur = chunk + BUMP_HEAD + ALIGN(sizeof(mm_arena_t));
+    ar->end = chunk + BUMP_CHUNK;
+    return ar;
+}
+
+/**
+ * mm_arena_alloc - bump @param: size Bytes(8 Bytes aligned) off the newest chunk of
+ * @param: ar, a new chunk is taken once it runs out, large objects get chunks of their own
+ * which are linked behind the newest chunk, so the rest of it is still used
+ * @return NULL if memory runs out
+*/
+void *mm_arena_alloc(mm_arena_t *ar, size_t size)
+{
+    char* p;
+    if (size == 0 || size >= MAX_HEAP_LIMIT) return NULL;
+    size = ALIGN(size);
+    if (size <= (size_t)(ar->end - ar->cur)) {
+        p = ar->cur;
+        ar->cur += size;
+        return p;
+    }
+    if (size > BUMP_BIG) {
+        if ((p = mm_malloc(size + BUMP_HEAD)) == NULL) return NULL;
+        *(char**)p = *(char**)ar->chunk;
+        *(char**)ar->chunk = p;
+        return p + BUMP_HEAD;
+    }
+    if ((p = mm_malloc(BUMP_CHUNK)) == NULL) return NULL;
+    *(char**)p = ar->chunk;
+    ar->chunk = p;
+    ar->cur = p + BUMP_HEAD + size;
+    ar->end = p + BUMP_CHUNK;
+    return p + BUMP_HEAD;
+}
+
+/**
+ * mm_arena_reset - release every object of @param: ar at once, all chunks but the first
+ * are freed by mm_free_batch, so chunks carved next to each other are coalesced only once
+*/
+void mm_arena_reset(mm_arena_t *ar)
+{
+    char* first = (char*)ar - BUMP_HEAD;
+    char* p = ar->chunk;
+    void* ptrs[BUMP_BATCH];
+    size_t n = 0;
+    while (p != NULL) {
+        char* ne = *(char**)p;
+        if (p != first) ptrs[n++] = p;
+        if (n == BUMP_BATCH) {
+            mm_free_batch(ptrs, n);
+            n = 0;
+        }
+        p = ne;
+    }
+    mm_free_batch(ptrs, n);
+    *(char**)first = NULL;
+    ar->chunk = first;
+    ar->cur = first + BUMP_HEAD + ALIGN(sizeof(mm_arena_t));
+    ar->end = first + BUMP_CHUNK;
+}
+
+/**
+ * mm_arena_destroy - release @param: ar with all of its objects
+*/
+void mm_arena_destroy(mm_arena_t *ar)
+{
+    mm_arena_reset(ar);
+    mm_free((char*)ar - BUMP_HEAD);
+}
+
+/**
+ * arena_init - build an empty heap of arena @param: a in memlib region @param: region
  * prologue block and epilogue block are 4 Bytes, they are marked with block size zero
  * prologue block begins from the heap, every list has an epilogue block
 */
-int mm_init(void)
+static int arena_init(arena_t* a, mem_region_t* region)
 {
+    a->region = region;
+    a->lo = mem_region_lo(region);
+    a->cap = mem_region_capacity(region);
     // create prologue block and epilogue block 
-    if ((heapp = mem_sbrk(2 * MIN_UNIT)) == (void*)-1) return -1;
+    if ((a->heapp = mem_region_sbrk(a->region, 2 * MIN_UNIT)) == (void*)-1) return -1;
     // mark prologue block
-    PACK(heapp, 0, 0, 1);
+    PACK(a->heapp, 0, 0, 1);
     // mark epilogue block
-    PACK(heapp + MIN_UNIT, 0, 1, 1);
-    int i;
+    PACK(a->heapp + MIN_UNIT, 0, 1, 1);
+    int i, j;
     // initialize segregated list
-    for (i = 0; i < LIST_SIZE; i++) list[i] = NULL_ADD;
-    extend_heap(MIN_CHUNK);
+    for (i = 0; i < TREE_FL; i++) {
+        for (j = 0; j < SL_COUNT; j++) a->list[i][j] = a->rover[i][j] = NULL_ADD;
+        a->sl_map[i] = 0;
+    }
+    for (i = 0; i < FL_COUNT; i++) a->tree[i] = NULL_ADD;
+    a->fl_map = 0;
+    for (i = 0; i < QUICK_CLASSES; i++) a->quick[i] = NULL_ADD;
+    a->quick_map = 0;
+    for (i = 0; i < SLAB_CLASSES; i++) a->slabs[i] = NULL_ADD;
+    for (i = 0; i < (a->cap + 32 * SLAB_PAGE - 1) / SLAB_PAGE / 32; i++) a->slab_map[i] = 0;
+    a->slack = 0;
+    a->fresh = 0;
+    a->epoch = 0;
+#if MM_PURGE_DECAY
+    a->epoch_start = now_ms();
+    a->frees = 0;
+#endif
+#ifdef MM_THREADS
+    pthread_mutex_init(&a->lock, NULL);
+    a->remote = NULL;
+#endif
+    extend_heap(a, MIN_CHUNK);
     return 0;
 }
 
 /**
- * mm_malloc - Allocate a block by incrementing the brk pointer.
- *     Always allocate a block whose size is a multiple of the alignment.
+ * @return arena or private heap whose region contains @param: ptr, NULL if @param: ptr is a mapped block
 */
-void *mm_malloc(size_t size)
+static arena_t* arena_of(void* ptr) {
+    int i;
+    arena_t* a;
+    for (i = 0; i < ARENA_COUNT; i++) {
+        a = &arenas[i];
+        if (!__atomic_load_n(&a->ready, __ATOMIC_ACQUIRE)) continue;
+        if ((size_t)((char*)ptr - a->lo) < a->cap) return a;
+    }
+    if (__atomic_load_n(&heaps, __ATOMIC_ACQUIRE) == NULL) return NULL;
+    // a heap may be destroyed by another thread, keep it while it is searched
+#ifdef MM_THREADS
+    pthread_mutex_lock(&arena_lock);
+#endif
+    for (a = heaps; a != NULL && (size_t)((char*)ptr - a->lo) >= a->cap; a = a->next);
+#ifdef MM_THREADS
+    pthread_mutex_unlock(&arena_lock);
+#endif
+    return a;
+}
+
+/**
+ * @return arena of current thread
+*/
+static arena_t* my_arena(void) {
+#ifdef MM_THREADS
+    if (thread_arena != NULL) return thread_arena;
+    // assign arenas round-robin, arena is initialized by its first thread
+    arena_t* a = &arenas[__atomic_fetch_add(&arena_next, 1, __ATOMIC_RELAXED) % ARENA_COUNT];
+    if (!__atomic_load_n(&a->ready, __ATOMIC_ACQUIRE)) {
+        pthread_mutex_lock(&arena_lock);
+        if (!a->ready) {
+            mem_region_t* region = mem_region_create();
+            if (region == NULL || arena_init(a, region) < 0) {
+                if (region != NULL) mem_region_destroy(region);
+                pthread_mutex_unlock(&arena_lock);
+                // no address space left for another heap, share the first arena
+                thread_arena = &arenas[0];
+                return thread_arena;
+            }
+            // publish arena only after it is completely built
+            __atomic_store_n(&a->ready, 1, __ATOMIC_RELEASE);
+        }
+        pthread_mutex_unlock(&arena_lock);
+    }
+    thread_arena = a;
+    return a;
+#else
+    return &arenas[0];
+#endif
+}
+
+/**
+ * heap_malloc - allocate a block from slab pages or segregated list
+ * caller should hold heap lock
+*/
+static void* heap_malloc(arena_t* a, size_t size)
 {
-    if (size == 0) return NULL;
+    return heap_malloc_hint(a, size, 0);
+}
+
+/**
+ * heap_malloc_hint - heap_malloc with lifetime @param: hint, a short-lived block is carved
+ * from the end of its free block, a long-lived one from the beginning; without a hint(0)
+ * the end is chosen by split_size
+ * caller should hold heap lock
+*/
+static void* heap_malloc_hint(arena_t* a, size_t size, int hint)
+{
+    // small requests are carved from slab pages without header
+    if (size < SLAB_MAX) return slab_alloc(a, size);
     // every allocated block has a header with 4 Bytes
     size += MIN_UNIT;
     size = ALIGN(size);
     if (size < MIN_BLOCK) size = MIN_BLOCK;
-    int idx;
-    for (idx = high_bit(size); idx < LIST_SIZE; idx++) {
-        ULL header;
-        for (header = list[idx]; header != NULL_ADD; header = *(ULL*)(header + MIN_UNIT + ADD_LEN)) {
-            UI tmp_size = BLOCK_SIZE((void*)header);
-            if (tmp_size >= size) return allocate_block((void*)header, size);
-        }
+    // same size churn is served by quick lists without touching free lists
+    if (size <= QUICK_MAX && a->quick[(size >> 3) - 1] != NULL_ADD) {
+        int cls = (size >> 3) - 1;
+        void* header = TO_PTR(a, a->quick[cls]);
+        if ((a->quick[cls] = QUICK_NEXT(header)) == NULL_ADD) a->quick_map &= ~(1ULL << cls);
+        return header + MIN_UNIT;
+    }
+    void* header = find_block(a, size);
+    if (header == NULL) return NULL;
+    int tail = hint ? hint == MM_SHORT : split_size != 0 && size >= split_size;
+    return tail ? allocate_tail(a, header, size) : allocate_block(a, header, size);
+}
+
+/**
+ * heap_calloc - allocate a block with @param: size Bytes zeroed payload
+ * slab slots and blocks of quick lists are recycled and cleared completely
+ * caller should hold heap lock
+*/
+static void* heap_calloc(arena_t* a, size_t size)
+{
+    void* ptr;
+    UI bsize = ALIGN(size + MIN_UNIT);
+    if (size < SLAB_MAX || (bsize <= QUICK_MAX && a->quick[(bsize >> 3) - 1] != NULL_ADD)) {
+        if ((ptr = heap_malloc(a, size)) != NULL) memset(ptr, 0, size);
+        return ptr;
     }
-    void* header = extend_heap(size);
+    void* header = find_block(a, bsize);
     if (header == NULL) return NULL;
-    return allocate_block(header, size);
-    
+    // allocate_block moves the mark of fresh heap past the block
+    UI fresh = a->fresh;
+    ptr = allocate_block(a, header, bsize);
+    clear_block(a, header, fresh, size);
+    return ptr;
+}
+
+/**
+ * find a free block with at least @param: size Bytes, quick lists are merged and
+ * slack of grown blocks is given back before the heap grows
+ * @return header of free block, NULL if the heap cannot grow
+*/
+static void* find_block(arena_t* a, UI size)
+{
+    void* header = find_fit(a, size);
+    // merge blocks of quick lists before the heap grows
+    if (header == NULL && a->quick_map) {
+        quick_flush(a);
+        header = find_fit(a, size);
+    }
+    // give slack of grown blocks back before the heap grows
+    if (header == NULL && a->slack >= size && reclaim_slack(a)) header = find_fit(a, size);
+    if (header == NULL) header = extend_heap(a, size);
+    return header;
+}
+
+/**
+ * zero the first @param: size Bytes of payload of block @param: header, which was just
+ * carved from a free block starting at the same header; heap from offset @param: fresh on
+ * is zero except the links and the footer that free block had
+*/
+static void clear_block(arena_t* a, void* header, UI fresh, size_t size)
+{
+    char* ptr = header + MIN_UNIT;
+    char* clean = TO_PTR(a, fresh);
+    if (clean < (char*)header + TREE_HEAD) clean = header + TREE_HEAD;
+    if (clean >= ptr + size) {
+        memset(ptr, 0, size);
+        return;
+    }
+    memset(ptr, 0, clean - ptr);
+    // footer of a free block taken as a whole
+    char* footer = GET_FOOTER(header);
+    if (footer < ptr + size) *(UI*)footer = 0;
 }
 
 /*
- * mm_free - Freeing a block does nothing.
+ * heap_malloc_batch - allocate @param: n blocks of @param: size Bytes to @param: out,
+ * quick list of their size is emptied first, the others are carved from one free block
+ * per chunk of at most MMAP_THRESHOLD Bytes(or of one block, if it is larger), which is
+ * detached only once; free blocks too small for a whole chunk take as many blocks as
+ * they hold before the heap grows
+ * caller should hold heap lock
  */
-void mm_free(void *ptr)
+static size_t heap_malloc_batch(arena_t* a, size_t size, size_t n, void** out)
+{
+    size_t i = 0;
+    if (size < SLAB_MAX) {
+        for (; i < n && (out[i] = slab_alloc(a, size)) != NULL; i++);
+        return i;
+    }
+    UI bsize = ALIGN(size + MIN_UNIT);
+    if (bsize <= QUICK_MAX) {
+        int cls = (bsize >> 3) - 1;
+        for (; i < n && a->quick[cls] != NULL_ADD; i++) {
+            void* header = TO_PTR(a, a->quick[cls]);
+            a->quick[cls] = QUICK_NEXT(header);
+            out[i] = header + MIN_UNIT;
+        }
+        if (a->quick[cls] == NULL_ADD) a->quick_map &= ~(1ULL << cls);
+    }
+    while (i < n) {
+        UI count = MMAP_THRESHOLD / bsize;
+        if (count == 0) count = 1;
+        if (count > n - i) count = n - i;
+        void* header = find_fit(a, count * bsize);
+        // fill smaller free blocks before the heap grows
+        if (header == NULL) header = find_fit(a, bsize);
+        if (header == NULL && a->quick_map) {
+            quick_flush(a);
+            header = find_fit(a, bsize);
+        }
+        if (header == NULL && (header = extend_heap(a, count * bsize)) == NULL) {
+            // no room for the whole chunk, remaining blocks are allocated one by one
+            for (; i < n && (out[i] = heap_malloc(a, size)) != NULL; i++);
+            return i;
+        }
+        if (BLOCK_SIZE(header) < count * bsize) count = BLOCK_SIZE(header) / bsize;
+        header = allocate_block(a, header, count * bsize) - MIN_UNIT;
+        // the last block also takes the tail too small to be split off
+        UI rest = BLOCK_SIZE(header);
+        for (; count > 1; count--) {
+            NEW_SIZE(header, bsize);
+            out[i++] = header + MIN_UNIT;
+            header += bsize;
+            rest -= bsize;
+            PACK(header, rest, 1, 1);
+        }
+        out[i++] = header + MIN_UNIT;
+    }
+    return i;
+}
+
+/**
+ * merge heap block @param: ptrs[i] with the blocks of @param: ptrs right behind it in the heap
+ * into one allocated block, @param: ptrs is sorted by address
+ * @return index of the first block of @param: ptrs not merged
+*/
+static size_t merge_run(arena_t* a, void** ptrs, size_t i, size_t n)
+{
+    void* header = ptrs[i] - MIN_UNIT;
+    UI size = BLOCK_SIZE(header);
+    if (*(UI*)header & GROWN) {
+        a->slack -= grown_slack(header);
+        *(UI*)header &= ~GROWN;
+    }
+    // the payload of a slab page is its slab header, never a pointer returned to caller
+    for (i++; i < n && ptrs[i] == header + size + MIN_UNIT; i++) {
+        void* ne = header + size;
+        if (*(UI*)ne & GROWN) a->slack -= grown_slack(ne);
+        size += BLOCK_SIZE(ne);
+    }
+    NEW_SIZE(header, size);
+    return i;
+}
+
+/* compare two pointers by address, for qsort */
+static int ptr_cmp(const void* x, const void* y)
+{
+    char* p = *(char**)x;
+    char* q = *(char**)y;
+    return p < q ? -1 : p > q;
+}
+
+/*
+ * heap_free - return a block to slab pages, quick lists or segregated list
+ * caller should hold heap lock
+ */
+static void heap_free(arena_t* a, void* ptr)
+{
+    if (slab_page(a, ptr) != NULL) {
+        slab_free(a, ptr);
+        return;
+    }
+    void* header = ptr - MIN_UNIT;
+    UI size = BLOCK_SIZE(header);
+    if (*(UI*)header & GROWN) a->slack -= grown_slack(header);
+    // small blocks are not coalesced until an allocation fails, they stay marked allocated
+    else if (size <= QUICK_MAX) {
+        quick_push(a, header, size);
+        return;
+    }
+    header = release_block(a, header);
+    trim_heap(a, header);
+#if MM_PURGE_DECAY
+    if (++a->frees >= PURGE_TICK) decay_purge(a);
+#endif
+}
+
+/**
+ * coalesce allocated block with @param: header and link it to segregated free list
+ * @return header of the coalesced free block
+*/
+static void* release_block(arena_t* a, void* header)
 {
     // coalesce block immediately
-    void* header = coalesce(ptr - MIN_UNIT);
+    header = coalesce(a, header);
     // link free block to segregated free list
-    link_to_list(header);
+    link_to_list(a, header);
     // clear next block's pre block allocation bit
     UI size = BLOCK_SIZE(header);
-    *(UI*)(header + size) &= ~2;
+    CLEAR_PRE(header + size);
+    return header;
+}
+
+/**
+ * push allocated block @param: header to the quick list of @param: size Bytes,
+ * the block may be up to MIN_BLOCK - 8 Bytes larger
+*/
+static void quick_push(arena_t* a, void* header, UI size)
+{
+    int cls = (size >> 3) - 1;
+    QUICK_NEXT(header) = a->quick[cls];
+    a->quick[cls] = TO_OFF(a, header);
+    a->quick_map |= 1ULL << cls;
+}
+
+/**
+ * coalesce every block of quick lists of arena @param: a in bulk
+*/
+static void quick_flush(arena_t* a)
+{
+    for (; a->quick_map; a->quick_map &= a->quick_map - 1) {
+        int cls = __builtin_ctzll(a->quick_map);
+        UI off = a->quick[cls];
+        a->quick[cls] = NULL_ADD;
+        while (off != NULL_ADD) {
+            void* header = TO_PTR(a, off);
+            off = QUICK_NEXT(header);
+            release_block(a, header);
+        }
+    }
 }
 
 /*
- * mm_realloc - Implemented simply in terms of mm_malloc and mm_free
+ * heap_realloc - resize a block in place if possible, otherwise move it
+ * caller should hold heap lock
  */
-void *mm_realloc(void *ptr, size_t size)
+static void* heap_realloc(arena_t* a, void* ptr, size_t size)
 {
-    if (ptr == NULL) return mm_malloc(size);
-    if (size == 0) {
-        mm_free(ptr);
-        return NULL;
+    slab_t* page = slab_page(a, ptr);
+    if (page != NULL) {
+        // slab slot is still large enough
+        if (size <= page->slot) return ptr;
+        void* ne_block = heap_malloc(a, size);
+        if (ne_block == NULL) return NULL;
+        memcpy(ne_block, ptr, page->slot);
+        slab_free(a, ptr);
+        return ne_block;
     }
-    UI request_size = size + MIN_UNIT;
-    request_size = ALIGN(request_size);
     void* header = ptr - MIN_UNIT;
     UI ori_size = BLOCK_SIZE(header);
+    UI grown = *(UI*)header & GROWN;
+    UI used = ori_size - MIN_UNIT;
+    if (grown) {
+        used = GROWN_USED(header);
+        a->slack -= grown_slack(header);
+        // growing block is served by its slack while the last word is still spare
+        if (size >= used && size + 2 * MIN_UNIT <= ori_size) {
+            GROWN_USED(header) = size;
+            a->slack += grown_slack(header);
+            return ptr;
+        }
+        *(UI*)header &= ~GROWN;
+    }
+    UI request_size = size + MIN_UNIT;
+    request_size = ALIGN(request_size);
+    if (request_size < MIN_BLOCK) request_size = MIN_BLOCK;
     // if original block is big enough, then we may want to return original block immediately
     // however we should check block size first, if @param:size is much smaller than block size
     // then we should split original block
     if (ori_size >= request_size) {
-        if (ori_size - request_size >= 24) split_block(header, request_size);
+        if (ori_size - request_size >= MIN_BLOCK) split_block(a, header, request_size);
         return ptr;
-    } else {
-        void* ne_block = mm_malloc(size);
-        memcpy(ne_block, ptr, ori_size - MIN_UNIT);
-        mm_free(ptr);
-        return ne_block;
     }
+    // growing block keeps a spare last word, a block grown again reserves geometric slack;
+    // blocks fitting quick lists are never grown, so mm_free_sized can tell them by size
+    int track = request_size > QUICK_MAX;
+    if (track) {
+        request_size = ALIGN(size + 2 * MIN_UNIT);
+        if (grown) request_size += ALIGN(request_size >> GROW_SHIFT);
+    }
+    // otherwise try to grow the block without copying
+    void* ne_header = grow_block(a, header, request_size);
+    if (ne_header == NULL) {
+        void* ne_block = heap_malloc(a, request_size - MIN_UNIT);
+        if (ne_block == NULL) return NULL;
+        memcpy(ne_block, ptr, used);
+        heap_free(a, ptr);
+        ne_header = ne_block - MIN_UNIT;
+    }
+    if (track) {
+        *(UI*)ne_header |= GROWN;
+        GROWN_USED(ne_header) = size;
+        a->slack += grown_slack(ne_header);
+    }
+    return ne_header + MIN_UNIT;
+}
+
+/**
+ * @return payload Bytes of allocated block @param: ptr which may hold data
+ * caller should hold heap lock
+*/
+static UI heap_usable(arena_t* a, void* ptr) {
+    slab_t* page = slab_page(a, ptr);
+    if (page != NULL) return page->slot;
+    void* header = ptr - MIN_UNIT;
+    if (*(UI*)header & GROWN) return GROWN_USED(header);
+    return BLOCK_SIZE(header) - MIN_UNIT;
+}
+
+/**
+ * @return Bytes a grown block @param: header could give back to heap
+*/
+static UI grown_slack(void* header) {
+    UI size = ALIGN(GROWN_USED(header) + MIN_UNIT);
+    if (size < MIN_BLOCK) size = MIN_BLOCK;
+    return BLOCK_SIZE(header) - size;
+}
+
+/**
+ * split the slack off every grown block of arena @param: a, blocks are no longer grown
+ * @return non-zero if any free block was created
+*/
+static int reclaim_slack(arena_t* a) {
+    int freed = 0;
+    void* header = a->heapp + MIN_UNIT;
+    for (; BLOCK_SIZE(header) != 0; header += BLOCK_SIZE(header)) {
+        if ((*(UI*)header & (GROWN | 1)) != (GROWN | 1)) continue;
+        UI slack = grown_slack(header);
+        *(UI*)header &= ~GROWN;
+        if (slack >= MIN_BLOCK) {
+            split_block(a, header, BLOCK_SIZE(header) - slack);
+            freed = 1;
+        }
+    }
+    a->slack = 0;
+    return freed;
+}
+
+/**
+ * grow allocated block @param: header to @param: size Bytes in place
+ * the free successor is absorbed first, a block reaching the top of heap extends the heap,
+ * at last the free predecessor is absorbed and payload is moved down
+ * @return new header of block, NULL if block cannot grow in place
+*/
+static void* grow_block(arena_t* a, void* header, UI size) {
+    UI ori_size = BLOCK_SIZE(header);
+    void* ne = header + ori_size;
+    UI ne_size = *(UI*)ne & 0x1 ? 0 : BLOCK_SIZE(ne);
+    UI avail = ori_size + ne_size;
+    // epilogue block follows current block and its free successor
+    if (avail < size && BLOCK_SIZE(ne + ne_size) == 0) {
+        // new space is coalesced with the free successor(if present)
+        if (extend_heap(a, size - avail) == NULL) return NULL;
+        ne_size = BLOCK_SIZE(ne);
+        avail = ori_size + ne_size;
+    }
+    UI pre_size = 0;
+    if (avail < size) {
+        if (*(UI*)header & 0x2) return NULL;
+        pre_size = BLOCK_SIZE(header - MIN_UNIT);
+        if (pre_size + avail < size) return NULL;
+    }
+    if (ne_size != 0) detach_off(a, ne);
+    if (pre_size != 0) {
+        void* pre = header - pre_size;
+        detach_off(a, pre);
+        // predecessor of a free block is always allocated
+        memmove(pre + MIN_UNIT, header + MIN_UNIT, ori_size - MIN_UNIT);
+        header = pre;
+        PACK(header, 0, 1, 1);
+    }
+    NEW_SIZE(header, pre_size + avail);
+    if (pre_size + avail - size >= MIN_BLOCK) split_block(a, header, size);
+    else SET_PRE(header + pre_size + avail);
+    DIRTY(a, header + BLOCK_SIZE(header));
+    return header;
 }
 
 /**
@@ -176,12 +1430,15 @@ void *mm_realloc(void *ptr, size_t size)
  * heap will extend at least MIN_CHUNK(4K) Bytes
  * @returns header of new block 
 */
-static void* extend_heap(size_t size) {
+static void* extend_heap(arena_t* a, size_t size) {
     if (size < MIN_CHUNK) size = MIN_CHUNK;
     // size round up to align 8 Bytes
     size = ALIGN(size);
     void* p;
-    if ((p = mem_sbrk(size)) == (void*)-1) return NULL;
+    // heap below the old top of the region may hold old data
+    UI fresh = TO_OFF(a, mem_region_clean(a->region));
+    if ((p = mem_region_sbrk(a->region, size)) == (void*)-1) return NULL;
+    a->fresh = fresh;
     // extend heap will request a new block at the top of heap
     // thus we need to exterminate old and create new epilogue block
     void* header = p - MIN_UNIT;
@@ -192,11 +1449,59 @@ static void* extend_heap(size_t size) {
     // rebuild epilogue block
     PACK(header + size, 0, 0, 1);
     // try to coalese new block with front block 
-    header = coalesce(header);
-    link_to_list(header);
+    header = coalesce(a, header);
+    link_to_list(a, header);
     // clear epilogue block's pre block allocation bit
     size = BLOCK_SIZE(header);
-    *(UI*)(header + size) &= ~2;
+    CLEAR_PRE(header + size);
+    return header;
+}
+
+/**
+ * give the top of free block @param: header back to the region of arena @param: a
+ * only a block followed by epilogue block and larger than TRIM_THRESHOLD Bytes is trimmed
+*/
+static void trim_heap(arena_t* a, void* header) {
+    UI size = BLOCK_SIZE(header);
+    if (size < TRIM_THRESHOLD || BLOCK_SIZE(header + size) != 0) return;
+    // shrunk block stays free, it moves to the list of its new size
+    detach_off(a, header);
+    REBUILD_HF(header, TRIM_PAD);
+    link_to_list(a, header);
+    // rebuild epilogue block at the new top of heap
+    PACK(header + TRIM_PAD, 0, 0, 1);
+    mem_region_sbrk(a->region, -(int)(size - TRIM_PAD));
+}
+
+/**
+ * allocate a block with @param: size Bytes whose payload is aligned to @param: align Bytes
+ * @param: align is a power of two, the first byte of heap is page aligned, so alignments
+ * up to a page are also relative to the heap
+ * leading part of the free block is split off as a new free block
+ * @return header of allocated block, NULL if the heap cannot grow
+*/
+static void* allocate_aligned(arena_t* a, UI align, UI size) {
+    // reserve enough slack for leading free block
+    void* header = find_block(a, size + align + MIN_BLOCK);
+    if (header == NULL) return NULL;
+    size_t offset = (size_t)header + MIN_UNIT;
+    UI pad = (align - (offset & (align - 1))) & (align - 1);
+    // leading block should be large enough to be a free block
+    while (pad != 0 && pad < MIN_BLOCK) pad += align;
+    if (pad != 0) {
+        UI ori_size = BLOCK_SIZE(header);
+        detach_off(a, header);
+        // shrink leading block, it is still free and in a free list
+        REBUILD_HF(header, pad);
+        link_to_list(a, header);
+        header += pad;
+        // the aligned block follows a free block
+        PACK(header, ori_size - pad, 0, 0);
+        REBUILD_HF(header, ori_size - pad);
+        if (ori_size - pad >= PURGE_MIN) STAMP(header) = a->epoch;
+        link_to_list(a, header);
+    }
+    allocate_block(a, header, size);
     return header;
 }
 
@@ -204,27 +1509,38 @@ static void* extend_heap(size_t size) {
  * coalesce current free block with physical pre and succ free blocks
  * @return new header
 */
-static void* coalesce(void* header) {
+static void* coalesce(arena_t* a, void* header) {
     UI size = BLOCK_SIZE(header);
     void* ne = header + size;
+    // merged block keeps the stamp of its largest part, current block is stamped with current period
+    UI stamp = a->epoch, largest = size;
     // if next block is free block
     if (!(*(UI*)ne & 0x1)) {
-        size += BLOCK_SIZE(ne);
-        detach_off(ne);
+        UI ne_size = BLOCK_SIZE(ne);
+        if (ne_size > largest && ne_size >= PURGE_MIN) {
+            largest = ne_size;
+            stamp = STAMP(ne);
+        }
+        size += ne_size;
+        detach_off(a, ne);
+        // links of next block end up inside the merged block
+        DIRTY(a, ne + TREE_HEAD);
     }
     // if pre block is free block
     if (!((*(UI*)header >> 1) & 0x1)) {
         UI pre_size =  BLOCK_SIZE(header - MIN_UNIT);
         void* pre = header - pre_size;
+        if (pre_size > largest && pre_size >= PURGE_MIN) stamp = STAMP(pre);
         size += pre_size;
-        detach_off(pre);
+        detach_off(a, pre);
         header = pre;
     }
-    // clear current block's allocation bit
-    *(UI*)header &= ~1;
+    if (size >= PURGE_MIN) STAMP(header) = stamp;
+    // clear current block's allocation bit and grown bit
+    *(UI*)header &= ~(GROWN | 1);
     REBUILD_HF(header, size);
     // clear next block's pre block allocation bit
-    *(UI*)(header + size) &= ~2;
+    CLEAR_PRE(header + size);
     return header;
 }
 
@@ -233,18 +1549,46 @@ static void* coalesce(void* header) {
  * physically, a free block may much larger than @param: size Bytes, free block may be splitted
  * allocate_block returns a pointer which points to the first byte in free block
 */
-static void* allocate_block(void* header, size_t size) {
+static void* allocate_block(arena_t* a, void* header, size_t size) {
     *(UI*)header |= 1;
-    detach_off(header);
+    detach_off(a, header);
     UI ori_size = BLOCK_SIZE(header);
-    // if remaining space is larger than 24 Bytes(minimum cost of free block)
+    // pages of a large remainder are not touched, it keeps the stamp of the free block
+    UI stamp = STAMP(header);
+    if (ori_size - size >= PURGE_MIN) {
+        split_block(a, header, size);
+        STAMP(header + size) = stamp;
+    }
+    // if remaining space is larger than MIN_BLOCK Bytes(minimum cost of free block)
     // then we should split the block
-    if (ori_size - size >= 24) split_block(header, size);
+    else if (ori_size - size >= MIN_BLOCK) split_block(a, header, size);
     // set next block's pre block allocation bit
-    else *(UI*)(header + ori_size) |= 2;
+    else SET_PRE(header + ori_size);
+    DIRTY(a, header + BLOCK_SIZE(header));
     return header + MIN_UNIT;
 }
 
+/**
+ * allocate the last @param: size Bytes of free block @param: header, the leading part stays
+ * free with its header and stamp, so blocks carved from both ends of a free block grow
+ * towards each other
+ * @return payload of allocated block
+*/
+static void* allocate_tail(arena_t* a, void* header, UI size) {
+    UI ori_size = BLOCK_SIZE(header);
+    if (ori_size - size < MIN_BLOCK) return allocate_block(a, header, size);
+    detach_off(a, header);
+    REBUILD_HF(header, ori_size - size);
+    link_to_list(a, header);
+    void* block = header + ori_size - size;
+    // the allocated block follows a free block
+    PACK(block, size, 0, 1);
+    // set next block's pre block allocation bit
+    SET_PRE(block + size);
+    DIRTY(a, block + size);
+    return block + MIN_UNIT;
+}
+
 /**
  * split original block with the first block has size @param: size
  * the first block will be considered as allocated block
@@ -252,66 +1596,612 @@ static void* allocate_block(void* header, size_t size) {
  * after splitting a free block, split_block will call coalesce
  * to merge the second free block and the next free block(if present)
 */
-static void split_block(void* header, UI size) {
+static void split_block(arena_t* a, void* header, UI size) {
     // rebuild first block's header
     UI ori_size = BLOCK_SIZE(header);
     NEW_SIZE(header, size);
     UI ne_size = ori_size - size;
     void* ne = header + size;
-    *(UI*)(ne) |= 0x2;
-    *(UI*)(ne) &= ~0x1;
     // rebuild next block's header and footer
+    PACK(ne, ne_size, 1, 0);
     REBUILD_HF(ne, ne_size);
-    ne = coalesce(ne);
-    link_to_list(ne);
-    // clear next block's pre block allocation bit
-    *(UI*)(ne + ne_size) &= ~0x2;
+    // coalesce also clears next block's pre block allocation bit
+    ne = coalesce(a, ne);
+    link_to_list(a, ne);
+}
+
+
+/**
+ * find a free block with at least @param: size Bytes
+ * the exact bin is searched by the fit policy first, after that the smallest
+ * non-empty larger bin is taken, every block there is large enough;
+ * requests of at least TREE_MIN Bytes get the best fit from the size tries
+ * @return header of free block, NULL if there is no such block
+*/
+static void* find_fit(arena_t* a, UI size) {
+    if (size >= TREE_MIN) return tree_fit(a, size);
+    int fl, sl;
+    mapping(size, &fl, &sl);
+    void* header = list_fit(a, fl, sl, size);
+    if (header != NULL) return header;
+    UI map = a->sl_map[fl] & (~0U << (sl + 1));
+    if (!map) {
+        map = a->fl_map & (~0U << (fl + 1));
+        if (!map) return NULL;
+        fl = __builtin_ctz(map);
+        // smallest block of a trie class
+        if (fl >= TREE_FL) return tree_fit(a, 1U << (fl + FL_SHIFT - 1));
+        map = a->sl_map[fl];
+    }
+    sl = __builtin_ctz(map);
+    return list_fit(a, fl, sl, 0);
+}
+
+/**
+ * pick a block with at least @param: size Bytes from list[fl][sl] by the fit policy:
+ * first fit takes the first one among FIT_SCAN blocks, best fit the smallest one of the list,
+ * next fit the first one from the rover of the list on, wrapping around to its head
+ * @return header of free block, NULL if no block of the list is large enough
+*/
+static void* list_fit(arena_t* a, int fl, int sl, UI size) {
+    UI off = a->list[fl][sl];
+    int n;
+    if (fit_policy == MM_BEST_FIT) {
+        UI best = NULL_ADD, rest = ~0U;
+        for (; off != NULL_ADD; off = SUCC(TO_PTR(a, off))) {
+            UI block_size = BLOCK_SIZE(TO_PTR(a, off));
+            if (block_size < size || block_size - size >= rest) continue;
+            best = off;
+            if ((rest = block_size - size) == 0) break;
+        }
+        return best == NULL_ADD ? NULL : TO_PTR(a, best);
+    }
+    if (fit_policy == MM_NEXT_FIT) {
+        UI start = a->rover[fl][sl] != NULL_ADD ? a->rover[fl][sl] : off;
+        for (off = start; off != NULL_ADD;) {
+            void* header = TO_PTR(a, off);
+            // detaching the block moves rover to its successor
+            if (BLOCK_SIZE(header) >= size) {
+                a->rover[fl][sl] = off;
+                return header;
+            }
+            if ((off = SUCC(header)) == NULL_ADD) off = a->list[fl][sl];
+            if (off == start) break;
+        }
+        return NULL;
+    }
+    for (n = 0; off != NULL_ADD && n < FIT_SCAN; n++) {
+        void* header = TO_PTR(a, off);
+        if (BLOCK_SIZE(header) >= size) return header;
+        off = SUCC(header);
+    }
+    return NULL;
+}
+
+/**
+ * best fit for @param: size(at least TREE_MIN) Bytes, the trie of a class branches on
+ * the size bits below the leading one, so the path of size passes the blocks closest to it,
+ * the smallest block of a subtree lies on its leftmost path
+ * @return header of the smallest free block large enough, NULL if there is no such block
+*/
+static void* tree_fit(arena_t* a, UI size) {
+    int bit = high_bit(size);
+    int fl = bit - FL_SHIFT + 1, shift = bit - 1;
+    // Bytes left over by best block, blocks smaller than size wrap around to larger values
+    UI best = NULL_ADD, rest = -size;
+    // deepest right subtree beside the path, all of its blocks are larger than size
+    UI right = NULL_ADD;
+    UI off = a->tree[fl];
+    while (off != NULL_ADD) {
+        void* node = TO_PTR(a, off);
+        UI left = BLOCK_SIZE(node) - size;
+        if (left < rest) {
+            best = off;
+            if ((rest = left) == 0) return node;
+        }
+        UI rt = CHILD(node, 1);
+        off = CHILD(node, (size >> shift) & 1);
+        shift--;
+        if (rt != NULL_ADD && rt != off) right = rt;
+    }
+    off = right;
+    if (off == NULL_ADD && best == NULL_ADD) {
+        // every block of a larger class is large enough
+        UI map = a->fl_map & (~0U << (fl + 1));
+        if (!map) return NULL;
+        off = a->tree[__builtin_ctz(map)];
+    }
+    for (; off != NULL_ADD; off = CHILD(TO_PTR(a, off), CHILD(TO_PTR(a, off), 0) == NULL_ADD)) {
+        UI left = BLOCK_SIZE(TO_PTR(a, off)) - size;
+        if (left < rest) {
+            best = off;
+            rest = left;
+        }
+    }
+    return best == NULL_ADD ? NULL : TO_PTR(a, best);
+}
+
+/**
+ * add free block with @param: header(at least TREE_MIN Bytes) to the trie of its class,
+ * a block of a size already in the trie is chained behind that node through pre/succ
+*/
+static void tree_insert(arena_t* a, void* header) {
+    UI size = BLOCK_SIZE(header), off = TO_OFF(a, header);
+    int bit = high_bit(size);
+    int fl = bit - FL_SHIFT + 1, shift = bit - 1;
+    PRED(header) = SUCC(header) = NULL_ADD;
+    CHILD(header, 0) = CHILD(header, 1) = NULL_ADD;
+    if (a->tree[fl] == NULL_ADD) {
+        a->tree[fl] = off;
+        PARENT(header) = TREE_ROOT;
+        a->fl_map |= 1U << fl;
+        return;
+    }
+    void* node = TO_PTR(a, a->tree[fl]);
+    while (BLOCK_SIZE(node) != size) {
+        UI* child = &CHILD(node, (size >> shift) & 1);
+        shift--;
+        if (*child == NULL_ADD) {
+            *child = off;
+            PARENT(header) = TO_OFF(a, node);
+            return;
+        }
+        node = TO_PTR(a, *child);
+    }
+    PARENT(header) = NULL_ADD;
+    PRED(header) = TO_OFF(a, node);
+    SUCC(header) = SUCC(node);
+    if (SUCC(node) != NULL_ADD) PRED(TO_PTR(a, SUCC(node))) = off;
+    SUCC(node) = off;
 }
 
+/**
+ * detach free block with @param: header(at least TREE_MIN Bytes) from the trie of its class,
+ * a trie node is replaced by the next block of its size, or by any leaf below it
+*/
+static void tree_remove(arena_t* a, void* header) {
+    UI off = TO_OFF(a, header), parent = PARENT(header), pre = PRED(header), ne = SUCC(header);
+    if (parent == NULL_ADD) {
+        // chained block, not a trie node
+        SUCC(TO_PTR(a, pre)) = ne;
+        if (ne != NULL_ADD) PRED(TO_PTR(a, ne)) = pre;
+        return;
+    }
+    UI r = ne;
+    void* rep = NULL;
+    if (r != NULL_ADD) {
+        rep = TO_PTR(a, r);
+        PRED(rep) = NULL_ADD;
+    } else if ((r = CHILD(header, 1) != NULL_ADD ? CHILD(header, 1) : CHILD(header, 0)) != NULL_ADD) {
+        // every block below a node shares its position in the trie, so a leaf can take its place
+        rep = TO_PTR(a, r);
+        while (CHILD(rep, 0) != NULL_ADD || CHILD(rep, 1) != NULL_ADD)
+            rep = TO_PTR(a, CHILD(rep, 1) != NULL_ADD ? CHILD(rep, 1) : CHILD(rep, 0));
+        r = TO_OFF(a, rep);
+        void* lp = TO_PTR(a, PARENT(rep));
+        CHILD(lp, CHILD(lp, 0) != r) = NULL_ADD;
+    }
+    if (rep != NULL) {
+        int i;
+        PARENT(rep) = parent;
+        for (i = 0; i < 2; i++) {
+            CHILD(rep, i) = CHILD(header, i);
+            if (CHILD(rep, i) != NULL_ADD) PARENT(TO_PTR(a, CHILD(rep, i))) = r;
+        }
+    }
+    if (parent == TREE_ROOT) {
+        int fl = high_bit(BLOCK_SIZE(header)) - FL_SHIFT + 1;
+        a->tree[fl] = r;
+        if (r == NULL_ADD) a->fl_map &= ~(1U << fl);
+    } else {
+        void* pp = TO_PTR(a, parent);
+        CHILD(pp, CHILD(pp, 0) != off) = r;
+    }
+}
 
 /**
- * add free block with @param: header to free list
+ * add free block with @param: header to free list,
+ * at the head of its list or at its address among the list(MM_ADDR_ORDER)
 */
-static void link_to_list(void* header) {
-    int size = BLOCK_SIZE(header);
+static void link_to_list(arena_t* a, void* header) {
+    if (BLOCK_SIZE(header) >= TREE_MIN) {
+        tree_insert(a, header);
+        return;
+    }
+    int fl, sl;
     // find suitable list
-    int idx = high_bit(size);
-    *(ULL*)(header + MIN_UNIT) = NULL_ADD;
+    mapping(BLOCK_SIZE(header), &fl, &sl);
+    UI off = TO_OFF(a, header), pre = NULL_ADD, ne = a->list[fl][sl];
+    if (order_policy == MM_ADDR_ORDER) {
+        for (; ne != NULL_ADD && ne < off; ne = SUCC(TO_PTR(a, ne))) pre = ne;
+    }
     // link free block to segregated list
-    *(ULL*)(header + MIN_UNIT + ADD_LEN) = list[idx];
-    if (list[idx] != NULL_ADD) *(ULL*)(list[idx] + MIN_UNIT) = (ULL)header;
-    // link current block to list
-    list[idx] = (ULL)header;
+    PRED(header) = pre;
+    SUCC(header) = ne;
+    if (ne != NULL_ADD) PRED(TO_PTR(a, ne)) = off;
+    if (pre != NULL_ADD) SUCC(TO_PTR(a, pre)) = off;
+    else a->list[fl][sl] = off;
+    a->fl_map |= 1U << fl;
+    a->sl_map[fl] |= 1U << sl;
 }
 
 /**
  * detach current free block from segregated free list
 */
-static void detach_off(void* header) {
-    UI size = BLOCK_SIZE(header);
-    int idx = high_bit(size);
-    ULL pre = *(ULL*)(header + MIN_UNIT);
-    ULL ne = *(ULL*)(header + MIN_UNIT + ADD_LEN);
-    if (pre == NULL_ADD && ne == NULL_ADD) list[idx] = NULL_ADD;
-    else {
+static void detach_off(arena_t* a, void* header) {
+    if (BLOCK_SIZE(header) >= TREE_MIN) {
+        tree_remove(a, header);
+        return;
+    }
+    int fl, sl;
+    mapping(BLOCK_SIZE(header), &fl, &sl);
+    UI pre = PRED(header);
+    UI ne = SUCC(header);
+    if (a->rover[fl][sl] == TO_OFF(a, header)) a->rover[fl][sl] = ne;
+    if (pre == NULL_ADD && ne == NULL_ADD) {
+        a->list[fl][sl] = NULL_ADD;
+        a->sl_map[fl] &= ~(1U << sl);
+        if (!a->sl_map[fl]) a->fl_map &= ~(1U << fl);
+    } else {
         if (ne != NULL_ADD) {
-            *(ULL*)(ne + MIN_UNIT) = pre;
-            if (pre == NULL_ADD) list[idx] = ne;
+            PRED(TO_PTR(a, ne)) = pre;
+            if (pre == NULL_ADD) a->list[fl][sl] = ne;
+        }
+        if (pre != NULL_ADD) SUCC(TO_PTR(a, pre)) = ne;
+    }
+}
+
+/* mapped blocks */
+
+/**
+ * allocate a block with @param: size Bytes payload in a mapping of its own,
+ * its payload is aligned to @param: align Bytes(a power of two up to page size)
+*/
+static void* map_alloc(size_t size, size_t align) {
+    // payload is aligned to @param: align(at most a page) by its offset in the first page
+    size_t head = align > MAP_HEAD ? align : MAP_HEAD;
+    if (size > MAP_MAX) return NULL;
+    size_t len = PAGE_ALIGN(size + head);
+    char* p = mem_map(len);
+    if (p == NULL) return NULL;
+    *(ULL*)(p + head - MAP_HEAD) = len;
+    return p + head;
+}
+
+/**
+ * unmap block @param: ptr
+*/
+static void map_free(void* ptr) {
+    // pointers of no heap should be mappings
+    assert(mem_in_map(ptr, ptr));
+    mem_unmap(MAP_BASE(ptr));
+}
+
+/**
+ * resize mapped block @param: ptr without copying, the mapping may move
+ * block shrunk below half of MMAP_THRESHOLD moves back to heap
+*/
+static void* map_realloc(void* ptr, size_t size) {
+    assert(mem_in_map(ptr, ptr));
+    char* p = MAP_BASE(ptr);
+    size_t head = (char*)ptr - p;
+    if (size < MMAP_THRESHOLD / 2) {
+        void* ne_block = mm_malloc(size);
+        if (ne_block == NULL) return NULL;
+        memcpy(ne_block, ptr, size);
+        mem_unmap(p);
+        return ne_block;
+    }
+    if (size > MAP_MAX) return NULL;
+    size_t len = PAGE_ALIGN(size + head);
+    if (len == *(ULL*)((char*)ptr - MAP_HEAD)) return ptr;
+    if ((p = mem_remap(p, len)) == NULL) return NULL;
+    *(ULL*)(p + head - MAP_HEAD) = len;
+    return p + head;
+}
+
+/* purging */
+
+/**
+ * purge the pages inside free blocks of arena @param: a, header, links, stamp and footer are kept
+ * @param: lazy only purges blocks linked before the previous decay period that are not purged yet
+ * @return 1 if any page was purged
+*/
+static int purge_arena(arena_t* a, int lazy) {
+    int n, purged = 0;
+    // a trie is at most as deep as the number of size bits below the leading one
+    UI stack[32], off;
+    UI map = a->fl_map & (~0U << (high_bit(PURGE_MIN) - FL_SHIFT + 1));
+    for (; map; map &= map - 1) {
+        stack[0] = a->tree[__builtin_ctz(map)];
+        for (n = 1; n > 0;) {
+            char* node = TO_PTR(a, stack[--n]);
+            if (CHILD(node, 0) != NULL_ADD) stack[n++] = CHILD(node, 0);
+            if (CHILD(node, 1) != NULL_ADD) stack[n++] = CHILD(node, 1);
+            for (off = TO_OFF(a, node); off != NULL_ADD; off = SUCC(TO_PTR(a, off)))
+                purged |= purge_block(a, TO_PTR(a, off), lazy);
+        }
+    }
+    return purged;
+}
+
+/**
+ * purge the interior pages of free block with @param: header, see purge_arena
+*/
+static int purge_block(arena_t* a, char* header, int lazy) {
+    size_t page = mem_pagesize();
+    UI size = BLOCK_SIZE(header);
+    if (size < PURGE_MIN) return 0;
+    if (lazy && (STAMP(header) == PURGED || STAMP(header) + 1 >= a->epoch)) return 0;
+    STAMP(header) = PURGED;
+    size_t lo = ((size_t)header + TREE_HEAD + page - 1) & ~(page - 1);
+    size_t hi = ((size_t)header + size - MIN_UNIT) & ~(page - 1);
+    if (lo >= hi) return 0;
+    mem_purge((void*)lo, hi - lo);
+    return 1;
+}
+
+#if MM_PURGE_DECAY
+/**
+ * start a new decay period of arena @param: a once the current one is over,
+ * blocks which stayed free during the whole previous period are purged
+*/
+static void decay_purge(arena_t* a) {
+    a->frees = 0;
+    long long now = now_ms();
+    if (now - a->epoch_start < MM_PURGE_DECAY) return;
+    a->epoch++;
+    a->epoch_start = now;
+    purge_arena(a, 1);
+}
+
+/* @return monotonic time in ms */
+static long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+#endif
+
+/* slab allocator */
+
+/**
+ * allocate a slot for @param: size Bytes from slab page of its class
+ * a new page is requested from heap if there is no page with free slots
+*/
+static void* slab_alloc(arena_t* a, size_t size) {
+    UI slot = ALIGN(size);
+    int cls = (slot >> 3) - 1;
+    slab_t* page = (slab_t*)a->slabs[cls];
+    int i;
+    if (page == NULL) {
+        // slab page is an allocated block with its payload aligned to SLAB_PAGE
+        void* header = allocate_aligned(a, SLAB_PAGE, ALIGN(SLAB_PAGE + MIN_UNIT));
+        if (header == NULL) return NULL;
+        page = header + MIN_UNIT;
+        UI n = (SLAB_PAGE - SLAB_HEAD) / slot;
+        page->pre = page->succ = NULL_ADD;
+        page->slot = slot;
+        page->used = 0;
+        for (i = 0; i < SLAB_WORDS; i++) {
+            if (n >= 32) page->free_map[i] = ~0U;
+            else page->free_map[i] = (1U << n) - 1;
+            n = n >= 32 ? n - 32 : 0;
         }
-        if (pre != NULL_ADD) *(ULL*)(pre + MIN_UNIT + ADD_LEN) = ne;
+        UI idx = ((char*)page - a->lo) >> SLAB_SHIFT;
+        // slab_page reads the map without lock
+        __atomic_store_n(&a->slab_map[idx >> 5], a->slab_map[idx >> 5] | 1U << (idx & 31), __ATOMIC_RELAXED);
+        a->slabs[cls] = (ULL)page;
     }
+    for (i = 0; !page->free_map[i]; i++);
+    int bit = __builtin_ctz(page->free_map[i]);
+    page->free_map[i] &= ~(1U << bit);
+    page->used++;
+    // page is full now, take it off the list
+    if (page->used == (SLAB_PAGE - SLAB_HEAD) / slot) {
+        a->slabs[cls] = page->succ;
+        if (page->succ != NULL_ADD) ((slab_t*)page->succ)->pre = NULL_ADD;
+        page->succ = NULL_ADD;
+    }
+    return (char*)page + SLAB_HEAD + (i * 32 + bit) * slot;
+}
+
+/**
+ * return slot @param: ptr to its slab page
+ * page becomes empty will be returned to heap unless it is the only page of its class
+*/
+static void slab_free(arena_t* a, void* ptr) {
+    slab_t* page = slab_page(a, ptr);
+    UI slot = page->slot;
+    int cls = (slot >> 3) - 1;
+    UI idx = ((char*)ptr - (char*)page - SLAB_HEAD) / slot;
+    // full page is not in list, link it back
+    if (page->used == (SLAB_PAGE - SLAB_HEAD) / slot) {
+        page->pre = NULL_ADD;
+        page->succ = a->slabs[cls];
+        if (a->slabs[cls] != NULL_ADD) ((slab_t*)a->slabs[cls])->pre = (ULL)page;
+        a->slabs[cls] = (ULL)page;
+    }
+    page->free_map[idx >> 5] |= 1U << (idx & 31);
+    page->used--;
+    if (page->used == 0 && (page->pre != NULL_ADD || page->succ != NULL_ADD)) {
+        if (page->pre != NULL_ADD) ((slab_t*)page->pre)->succ = page->succ;
+        else a->slabs[cls] = page->succ;
+        if (page->succ != NULL_ADD) ((slab_t*)page->succ)->pre = page->pre;
+        idx = ((char*)page - a->lo) >> SLAB_SHIFT;
+        __atomic_store_n(&a->slab_map[idx >> 5], a->slab_map[idx >> 5] & ~(1U << (idx & 31)), __ATOMIC_RELAXED);
+        heap_free(a, page);
+    }
+}
+
+/**
+ * @return slab page containing @param: ptr, NULL if @param: ptr is not a slab slot
+*/
+static slab_t* slab_page(arena_t* a, void* ptr) {
+    UI idx = ((char*)ptr - a->lo) >> SLAB_SHIFT;
+    if (!(__atomic_load_n(&a->slab_map[idx >> 5], __ATOMIC_RELAXED) >> (idx & 31) & 1)) return NULL;
+    return (slab_t*)(a->lo + ((size_t)idx << SLAB_SHIFT));
+}
+
+#ifdef MM_THREADS
+/* per-thread cache */
+
+/**
+ * @return cache class serving request of @param: size Bytes, -1 if it is not cached
+ * slab slots map to classes below SLAB_CLASSES, blocks of segregated list map above
+*/
+static int cache_class(size_t size) {
+    if (size < SLAB_MAX) return (ALIGN(size) >> 3) - 1;
+    if (size <= CACHE_MAX) return (ALIGN(size + MIN_UNIT) >> 3) - 1;
+    return -1;
+}
+
+/**
+ * @return cache class of allocated block @param: ptr, -1 if it is not cached
+ * allocated block is owned by caller, so its slab page and the size in its header are
+ * stable without lock; neighbours may still flip the pre block allocation bit and other
+ * pages of the slab map word may change, so both words are read atomically
+*/
+static int block_class(arena_t* a, void* ptr) {
+    slab_t* page = slab_page(a, ptr);
+    if (page != NULL) return (page->slot >> 3) - 1;
+    UI word = __atomic_load_n((UI*)(ptr - MIN_UNIT), __ATOMIC_RELAXED);
+    UI size = word & ~0x7;
+    // blocks smaller than any segregated list class(shrunk by realloc) and grown blocks are not cached
+    if (word & GROWN) return -1;
+    if (size > SLAB_CLASSES << 3 && size < CACHE_CLASSES << 3) return (size >> 3) - 1;
+    return -1;
+}
+
+/**
+ * pop a block of class @param: cls from cache of current thread
+ * an empty cache is refilled with CACHE_BATCH blocks from arena of current thread
+*/
+static void* cache_alloc(int cls, size_t size) {
+    if (cache[cls] == NULL_ADD) {
+        int i;
+        arena_t* a = my_arena();
+        cache_register();
+        LOCK(a);
+        remote_drain(a);
+        for (i = 0; i < CACHE_BATCH; i++) {
+            void* ptr = heap_malloc(a, size);
+            if (ptr == NULL) break;
+            *(ULL*)ptr = cache[cls];
+            cache[cls] = (ULL)ptr;
+            cache_count[cls]++;
+        }
+        UNLOCK(a);
+        if (cache[cls] == NULL_ADD) return NULL;
+    }
+    void* ptr = (void*)cache[cls];
+    cache[cls] = *(ULL*)ptr;
+    cache_count[cls]--;
+    return ptr;
+}
+
+/**
+ * push block @param: ptr to cache of current thread
+ * a full cache returns CACHE_BATCH blocks to heap under heap lock
+*/
+static void cache_free(int cls, void* ptr) {
+    cache_register();
+    *(ULL*)ptr = cache[cls];
+    cache[cls] = (ULL)ptr;
+    if (++cache_count[cls] > CACHE_COUNT) cache_flush(cls, CACHE_BATCH);
+}
+
+/**
+ * return at most @param: count blocks of class @param: cls to their arenas
+ * blocks of arena of current thread are freed under a single lock,
+ * blocks of other arenas are queued to them
+*/
+static void cache_flush(int cls, UI count) {
+    arena_t* locked = NULL;
+    while (count-- && cache[cls] != NULL_ADD) {
+        void* ptr = (void*)cache[cls];
+        cache[cls] = *(ULL*)ptr;
+        cache_count[cls]--;
+        arena_t* a = arena_of(ptr);
+        if (a != thread_arena) {
+            remote_free(a, ptr);
+            continue;
+        }
+        if (locked == NULL) {
+            LOCK(a);
+            locked = a;
+        }
+        heap_free(a, ptr);
+    }
+    if (locked != NULL) UNLOCK(locked);
+}
+
+/**
+ * flush cache of current thread when it exits, called before its cache first holds a block,
+ * by a refill as well as by a free
+*/
+static void cache_register(void) {
+    if (cache_registered) return;
+    pthread_once(&cache_once, cache_key_init);
+    pthread_setspecific(cache_key, &cache_registered);
+    cache_registered = 1;
+}
+
+/* thread-specific data destructor, empties cache of exiting thread */
+static void cache_destroy(void* arg) {
+    int i;
+    for (i = 0; i < CACHE_CLASSES; i++) cache_flush(i, cache_count[i]);
+}
+
+static void cache_key_init(void) {
+    pthread_key_create(&cache_key, cache_destroy);
 }
 
+/* remote free queue */
+
+/**
+ * push block @param: ptr to remote free queue of arena @param: a without locking
+ * queue is a lock-free stack, only its consumer detaches nodes, so there is no ABA problem
+*/
+static void remote_free(arena_t* a, void* ptr) {
+    void* head = __atomic_load_n(&a->remote, __ATOMIC_RELAXED);
+    do {
+        *(void**)ptr = head;
+    } while (!__atomic_compare_exchange_n(&a->remote, &head, ptr, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/**
+ * free every block queued to arena @param: a, caller should hold lock of @param: a
+*/
+static void remote_drain(arena_t* a) {
+    if (__atomic_load_n(&a->remote, __ATOMIC_RELAXED) == NULL) return;
+    void* ptr = __atomic_exchange_n(&a->remote, NULL, __ATOMIC_ACQUIRE);
+    while (ptr != NULL) {
+        void* ne = *(void**)ptr;
+        heap_free(a, ptr);
+        ptr = ne;
+    }
+}
+#endif
+
 /* bit wise trick */
 
-/* round down to log @param:size(2 based) */
+/* round down to log @param:size(2 based), @param:val should not be zero */
 static int high_bit(UI val) {
-    int i, bit = 0;
-    for (i = 4; i >= 0; i--) {
-        if (val & b[i]) {
-            val >>= s[i];
-            bit |= s[i];
-        }
+    return 31 - __builtin_clz(val);
+}
+
+/**
+ * map block size to its two-level size class
+ * first level is the power of two range, second level is the linear bin inside that range
+*/
+static void mapping(UI size, int* fl, int* sl) {
+    if (size < SMALL_BLOCK) {
+        *fl = 0;
+        *sl = size >> 3;
+    } else {
+        int bit = high_bit(size);
+        *fl = bit - FL_SHIFT + 1;
+        *sl = (size >> (bit - SL_SHIFT)) ^ SL_COUNT;
     }
-    return bit;
 }
\ No newline at end of file
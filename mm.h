@@ -3,7 +3,51 @@
 extern int mm_init (void);
 extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
+extern void mm_free_sized(void *ptr, size_t size);
 extern void *mm_realloc(void *ptr, size_t size);
+extern void *mm_calloc(size_t nmemb, size_t size);
+extern void *mm_malloc_hint(size_t size, int hint);
+extern size_t mm_usable_size(void *ptr);
+extern void *mm_memalign(size_t alignment, size_t size);
+extern void *mm_aligned_alloc(size_t alignment, size_t size);
+extern size_t mm_malloc_batch(size_t size, size_t n, void **out);
+extern void mm_free_batch(void **ptrs, size_t n);
+extern int mm_trim(void);
+extern int mm_set_policy(int fit, int order);
+extern size_t mm_set_split(size_t threshold);
+
+/*
+ * independent heaps; a block is freed and resized through the heap it came from, or by
+ * mm_free, mm_free_sized, mm_free_batch, mm_realloc and mm_usable_size, which find the
+ * heap of any block by its address
+ */
+typedef struct mm_heap mm_heap_t;
+extern mm_heap_t *mm_heap_default(void);
+extern mm_heap_t *mm_heap_create(void);
+extern void mm_heap_destroy(mm_heap_t *h);
+extern void *mm_heap_malloc(mm_heap_t *h, size_t size);
+extern void mm_heap_free(mm_heap_t *h, void *ptr);
+extern void *mm_heap_realloc(mm_heap_t *h, void *ptr, size_t size);
+
+/* bump allocators, objects are released all at once by mm_arena_reset */
+typedef struct mm_arena mm_arena_t;
+extern mm_arena_t *mm_arena_create(void);
+extern void *mm_arena_alloc(mm_arena_t *ar, size_t size);
+extern void mm_arena_reset(mm_arena_t *ar);
+extern void mm_arena_destroy(mm_arena_t *ar);
+
+/* fit policies of the segregated lists, see mm_set_policy */
+#define MM_FIRST_FIT 0
+#define MM_BEST_FIT  1
+#define MM_NEXT_FIT  2
+/* insertion orders of the segregated lists */
+#define MM_LIFO       0
+#define MM_ADDR_ORDER 1
+/* lifetime hints of mm_malloc_hint */
+#define MM_SHORT 1
+#define MM_LONG  2
+/* default threshold of mm_set_split */
+#define MM_SPLIT_DEFAULT 256
 
 
 /* 
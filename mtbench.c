@@ -0,0 +1,262 @@
+/*
+ * mtbench.c - Measures the throughput of the thread-safe malloc package
+ *     (mm.c built with -DMM_THREADS) as the number of threads grows.
+ *
+ * Every thread owns a fixed number of slots and runs a random mix of
+ * mm_malloc/mm_free requests on them, so threads never share blocks.
+ * With -x the threads form a ring instead: every thread allocates
+ * blocks and hands them to the next thread, which frees them, so every
+ * free is a cross-thread free. The run is repeated for 1, 2, 4, ...
+ * threads and the aggregate throughput is printed together with the
+ * speedup over one thread.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "mm.h"
+#include "memlib.h"
+#include "ftimer.h"
+
+/* Misc */
+#define MAXTHREADS  64    /* max number of threads */
+#define SLOTS      512    /* live blocks per thread */
+#define QUEUE     1024    /* blocks in flight to one thread (-x) */
+
+/* Holds the params of one timed run */
+typedef struct {
+    int threads;          /* number of threads */
+    int ops;              /* requests per thread */
+    int libc;             /* use libc malloc instead of mm malloc */
+    int cross;            /* hand every block to another thread to free */
+} bench_t;
+
+/* Holds the params of one thread */
+typedef struct worker {
+    bench_t *bench;
+    unsigned seed;
+    struct worker *next;  /* thread the blocks are handed to (-x) */
+    char *queue[QUEUE];   /* blocks handed to this thread (-x) */
+    unsigned head;        /* next block to free, advanced by this thread */
+    unsigned tail;        /* next free entry, advanced by the producer */
+} worker_t;
+
+static void *worker(void *ptr);
+static void *cross_worker(void *ptr);
+static int drain(worker_t *w);
+static char *bench_malloc(bench_t *bench, unsigned *seed);
+static void bench_free(bench_t *bench, char *p);
+static void run_bench(void *ptr);
+static void usage(void);
+
+int main(int argc, char **argv)
+{
+    char c;
+    int i, max_threads = 8, run_libc = 0;
+    double secs, base = 0;
+    bench_t bench;
+
+    bench.ops = 1000000;
+    bench.cross = 0;
+    while ((c = getopt(argc, argv, "t:n:lxh")) != EOF) {
+        switch (c) {
+        case 't': /* Max number of threads */
+            max_threads = atoi(optarg);
+            break;
+        case 'n': /* Requests per thread */
+            bench.ops = atoi(optarg);
+            break;
+        case 'l': /* Run libc malloc as well */
+            run_libc = 1;
+            break;
+        case 'x': /* Free every block in another thread */
+            bench.cross = 1;
+            break;
+        case 'h':
+            usage();
+            exit(0);
+        default:
+            usage();
+            exit(1);
+        }
+    }
+    if (max_threads < 1 || max_threads > MAXTHREADS) {
+        fprintf(stderr, "Thread count must be between 1 and %d\n", MAXTHREADS);
+        exit(1);
+    }
+
+    mem_init();
+    for (bench.libc = 0; bench.libc <= run_libc; bench.libc++) {
+        printf("\nResults for %s malloc:\n", bench.libc ? "libc" : "mm");
+        printf("%7s%10s%10s%9s\n", "threads", "secs", "Kops", "speedup");
+        for (i = 1; i <= max_threads; i *= 2) {
+            bench.threads = i;
+            if (!bench.libc && mm_init() < 0) {
+                fprintf(stderr, "mm_init failed\n");
+                exit(1);
+            }
+            secs = ftimer_gettod(run_bench, &bench, 1);
+            if (i == 1)
+                base = secs;
+            printf("%7d%10.6f%10.0f%9.2f\n", i, secs,
+                   ((double)bench.ops * i / 1e3) / secs, base * i / secs);
+        }
+    }
+    mem_deinit();
+    exit(0);
+}
+
+/*
+ * run_bench - Start the threads of one run and wait for them, timed
+ *     by ftimer_gettod.
+ */
+static void run_bench(void *ptr)
+{
+    bench_t *bench = (bench_t *)ptr;
+    pthread_t tid[MAXTHREADS];
+    static worker_t workers[MAXTHREADS];
+    int i;
+
+    for (i = 0; i < bench->threads; i++) {
+        workers[i].bench = bench;
+        workers[i].seed = i + 1;
+        workers[i].next = &workers[(i + 1) % bench->threads];
+        workers[i].head = workers[i].tail = 0;
+    }
+    for (i = 0; i < bench->threads; i++) {
+        if (pthread_create(&tid[i], NULL,
+                           bench->cross ? cross_worker : worker,
+                           &workers[i]) != 0) {
+            fprintf(stderr, "pthread_create failed\n");
+            exit(1);
+        }
+    }
+    for (i = 0; i < bench->threads; i++)
+        pthread_join(tid[i], NULL);
+}
+
+/*
+ * worker - Allocate or free a random slot on every request. Most
+ *     requests are small, a few are a couple of KB.
+ */
+static void *worker(void *ptr)
+{
+    worker_t *w = (worker_t *)ptr;
+    bench_t *bench = w->bench;
+    char *blocks[SLOTS];
+    int i, slot;
+
+    memset(blocks, 0, sizeof(blocks));
+    for (i = 0; i < bench->ops; i++) {
+        slot = rand_r(&w->seed) % SLOTS;
+        if (blocks[slot] == NULL) {
+            blocks[slot] = bench_malloc(bench, &w->seed);
+            blocks[slot][0] = (char)slot;
+        } else {
+            bench_free(bench, blocks[slot]);
+            blocks[slot] = NULL;
+        }
+    }
+    for (slot = 0; slot < SLOTS; slot++) {
+        if (blocks[slot] != NULL)
+            bench_free(bench, blocks[slot]);
+    }
+    return NULL;
+}
+
+/*
+ * cross_worker - Allocate half of the requests and hand each block to
+ *     the next thread, free the blocks handed over by the thread before
+ *     as they arrive. A full queue of the next thread is waited for
+ *     while the own queue is drained, so the ring never deadlocks.
+ */
+static void *cross_worker(void *ptr)
+{
+    worker_t *w = (worker_t *)ptr;
+    worker_t *next = w->next;
+    bench_t *bench = w->bench;
+    int sent = 0, freed = 0, n, total = bench->ops / 2;
+    unsigned tail;
+    char *p;
+
+    while (sent < total || freed < total) {
+        if (sent < total) {
+            p = bench_malloc(bench, &w->seed);
+            p[0] = (char)sent;
+            tail = next->tail;
+            while (tail - __atomic_load_n(&next->head, __ATOMIC_ACQUIRE) == QUEUE) {
+                n = drain(w);
+                if (n == 0)
+                    sched_yield();
+                freed += n;
+            }
+            next->queue[tail % QUEUE] = p;
+            __atomic_store_n(&next->tail, tail + 1, __ATOMIC_RELEASE);
+            sent++;
+        }
+        n = drain(w);
+        if (n == 0 && sent == total)
+            sched_yield();
+        freed += n;
+    }
+    return NULL;
+}
+
+/*
+ * drain - Free the blocks in the queue of w, return how many
+ */
+static int drain(worker_t *w)
+{
+    unsigned head = w->head;
+    unsigned tail = __atomic_load_n(&w->tail, __ATOMIC_ACQUIRE);
+    int n = tail - head;
+
+    for (; head != tail; head++)
+        bench_free(w->bench, w->queue[head % QUEUE]);
+    __atomic_store_n(&w->head, head, __ATOMIC_RELEASE);
+    return n;
+}
+
+/*
+ * bench_malloc - Allocate a block, most are small, a few are a couple of KB
+ */
+static char *bench_malloc(bench_t *bench, unsigned *seed)
+{
+    int size = rand_r(seed) % 16 ? 8 + rand_r(seed) % 256
+                                 : 1 + rand_r(seed) % 4096;
+    char *p = bench->libc ? malloc(size) : mm_malloc(size);
+
+    if (p == NULL) {
+        fprintf(stderr, "malloc failed\n");
+        exit(1);
+    }
+    return p;
+}
+
+/*
+ * bench_free - Free a block of bench_malloc
+ */
+static void bench_free(bench_t *bench, char *p)
+{
+    if (bench->libc)
+        free(p);
+    else
+        mm_free(p);
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: mtbench [-hlx] [-t <n>] [-n <ops>]\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-n <ops>   Requests per thread (default 1000000).\n");
+    fprintf(stderr, "\t-t <n>     Max number of threads (default 8).\n");
+    fprintf(stderr, "\t-x         Free every block in another thread.\n");
+}